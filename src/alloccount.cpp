@@ -0,0 +1,136 @@
+#include "alloccount.h"
+
+#ifndef CHIP8_ALLOC_CHECK
+bool alloccount::enabled() { return false; }
+uint64_t alloccount::allocations() { return 0; }
+#else
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <new>
+
+namespace {
+std::atomic<uint64_t> count(0);
+
+void counted() { count.fetch_add(1, std::memory_order_relaxed); }
+} // namespace
+
+#ifdef __GLIBC__
+// The C allocation functions are replaced too, so SDL and libc are counted
+// along with operator new, which goes through them. glibc's own versions
+// stay reachable under their __libc_ names.
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *p, size_t size);
+void *__libc_memalign(size_t align, size_t size);
+void __libc_free(void *p);
+
+void *malloc(size_t size) {
+  counted();
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size) {
+  counted();
+  return __libc_calloc(n, size);
+}
+
+void *realloc(void *p, size_t size) {
+  counted();
+  return __libc_realloc(p, size);
+}
+
+void *memalign(size_t align, size_t size) {
+  counted();
+  return __libc_memalign(align, size);
+}
+
+void *aligned_alloc(size_t align, size_t size) {
+  counted();
+  return __libc_memalign(align, size);
+}
+
+int posix_memalign(void **out, size_t align, size_t size) {
+  if (align < sizeof(void *) || (align & (align - 1)) != 0) {
+    return EINVAL;
+  }
+  counted();
+  void *p = __libc_memalign(align, size);
+  if (p == NULL) {
+    return ENOMEM;
+  }
+  *out = p;
+  return 0;
+}
+
+void free(void *p) { __libc_free(p); }
+}
+
+namespace {
+void countNew() {} // malloc has counted it
+} // namespace
+#else
+namespace {
+void countNew() { counted(); }
+} // namespace
+#endif
+
+namespace {
+void *allocate(std::size_t size) {
+  countNew();
+  void *p = std::malloc(size ? size : 1);
+  if (p == NULL) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void *allocateAligned(std::size_t size, std::align_val_t align) {
+  countNew();
+  std::size_t a = static_cast<std::size_t>(align);
+  // aligned_alloc wants the size to be a multiple of the alignment
+  void *p = std::aligned_alloc(a, (size + a - 1) / a * a);
+  if (p == NULL) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+} // namespace
+
+bool alloccount::enabled() { return true; }
+
+uint64_t alloccount::allocations() {
+  return count.load(std::memory_order_relaxed);
+}
+
+void *operator new(std::size_t size) { return allocate(size); }
+void *operator new[](std::size_t size) { return allocate(size); }
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept {
+  countNew();
+  return std::malloc(size ? size : 1);
+}
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept {
+  countNew();
+  return std::malloc(size ? size : 1);
+}
+void *operator new(std::size_t size, std::align_val_t align) {
+  return allocateAligned(size, align);
+}
+void *operator new[](std::size_t size, std::align_val_t align) {
+  return allocateAligned(size, align);
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete[](void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::size_t) noexcept { std::free(p); }
+void operator delete(void *p, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t, std::align_val_t) noexcept {
+  std::free(p);
+}
+void operator delete[](void *p, std::size_t, std::align_val_t) noexcept {
+  std::free(p);
+}
+#endif
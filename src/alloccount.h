@@ -0,0 +1,16 @@
+#pragma once
+#include <cstdint>
+
+// Counts every heap allocation in the process (alloccount.cpp replaces the
+// global allocation functions). Used to check that the frame loop is
+// allocation free once warmed up: take allocations() after warmup and again
+// at exit. With glibc malloc, calloc, realloc and the aligned variants are
+// counted too, including calls inside SDL and libc; elsewhere only operator
+// new is.
+//
+// The replacements are only built with CHIP8_ALLOC_CHECK defined (make
+// alloccheck); other builds keep the stock allocator and count nothing.
+namespace alloccount {
+bool enabled();
+uint64_t allocations();
+}
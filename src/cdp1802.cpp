@@ -0,0 +1,374 @@
+#include "cdp1802.h"
+
+namespace {
+
+typedef int (*handler)(cdp1802 &c, uint8_t op);
+
+// Short branch condition N of 3N: taken, before negation by bit 3
+bool condition(const cdp1802 &c, int n) {
+  switch (n & 7) {
+  case (0):
+    return true; // BR, and SKP never
+  case (1):
+    return c.Q;
+  case (2):
+    return c.D == 0;
+  case (3):
+    return c.DF;
+  default: // B1-B4
+    return c.ef >> ((n & 7) - 4) & 1;
+  }
+}
+
+int idl(cdp1802 &c, uint8_t) {
+  c.idle = true;
+  return 2;
+}
+
+int ldn(cdp1802 &c, uint8_t op) {
+  c.D = c.read(c.R[op & 0xF]);
+  return 2;
+}
+
+int inc(cdp1802 &c, uint8_t op) {
+  c.R[op & 0xF]++;
+  return 2;
+}
+
+int dec(cdp1802 &c, uint8_t op) {
+  c.R[op & 0xF]--;
+  return 2;
+}
+
+int shortBranch(cdp1802 &c, uint8_t op) {
+  bool taken = condition(c, op & 0xF) != ((op & 0x8) != 0);
+  uint8_t target = c.read(c.R[c.P]);
+  if (taken) {
+    c.R[c.P] = (c.R[c.P] & 0xFF00) | target;
+  } else {
+    c.R[c.P]++;
+  }
+  return 2;
+}
+
+int lda(cdp1802 &c, uint8_t op) {
+  c.D = c.read(c.R[op & 0xF]++);
+  return 2;
+}
+
+int str(cdp1802 &c, uint8_t op) {
+  c.write(c.R[op & 0xF], c.D);
+  return 2;
+}
+
+int irx(cdp1802 &c, uint8_t) {
+  c.R[c.X]++;
+  return 2;
+}
+
+int out(cdp1802 &c, uint8_t op) {
+  c.io = {(uint8_t)(op & 7), false, c.read(c.R[c.X]++)};
+  return 2;
+}
+
+int nop(cdp1802 &, uint8_t) { return 2; }
+
+int inp(cdp1802 &c, uint8_t op) {
+  c.io = {(uint8_t)(op & 7), true, 0};
+  c.D = c.inData;
+  c.write(c.R[c.X], c.D);
+  return 2;
+}
+
+int ret(cdp1802 &c, uint8_t op) {
+  uint8_t t = c.read(c.R[c.X]++);
+  c.X = t >> 4;
+  c.P = t & 0xF;
+  c.IE = op == 0x70; // RET; DIS leaves them off
+  return 2;
+}
+
+// D = a + b + carry, DF = carry out
+void add(cdp1802 &c, uint8_t a, uint8_t b, int carry) {
+  int r = a + b + carry;
+  c.D = r;
+  c.DF = r > 0xFF;
+}
+
+// D = a - b - borrow, DF = no borrow
+void sub(cdp1802 &c, uint8_t a, uint8_t b, int borrow) {
+  int r = a - b - borrow;
+  c.D = r;
+  c.DF = r >= 0;
+}
+
+// 0x72-0x7F, the memory, carry and control group
+int misc(cdp1802 &c, uint8_t op) {
+  switch (op) {
+  case (0x72): // LDXA
+    c.D = c.read(c.R[c.X]++);
+    break;
+  case (0x73): // STXD
+    c.write(c.R[c.X]--, c.D);
+    break;
+  case (0x74): // ADC
+    add(c, c.read(c.R[c.X]), c.D, c.DF);
+    break;
+  case (0x75): // SDB
+    sub(c, c.read(c.R[c.X]), c.D, !c.DF);
+    break;
+  case (0x76): { // SHRC
+    bool carry = c.D & 1;
+    c.D = c.D >> 1 | c.DF << 7;
+    c.DF = carry;
+    break;
+  }
+  case (0x77): // SMB
+    sub(c, c.D, c.read(c.R[c.X]), !c.DF);
+    break;
+  case (0x78): // SAV
+    c.write(c.R[c.X], c.T);
+    break;
+  case (0x79): // MARK
+    c.T = c.X << 4 | c.P;
+    c.write(c.R[2], c.T);
+    c.X = c.P;
+    c.R[2]--;
+    break;
+  case (0x7A): // REQ
+    c.Q = false;
+    break;
+  case (0x7B): // SEQ
+    c.Q = true;
+    break;
+  case (0x7C): { // ADCI
+    uint8_t m = c.next();
+    add(c, m, c.D, c.DF);
+    break;
+  }
+  case (0x7D): { // SDBI
+    uint8_t m = c.next();
+    sub(c, m, c.D, !c.DF);
+    break;
+  }
+  case (0x7E): { // SHLC
+    bool carry = c.D >> 7;
+    c.D = c.D << 1 | c.DF;
+    c.DF = carry;
+    break;
+  }
+  default: { // 0x7F SMBI
+    uint8_t m = c.next();
+    sub(c, c.D, m, !c.DF);
+    break;
+  }
+  }
+  return 2;
+}
+
+int glo(cdp1802 &c, uint8_t op) {
+  c.D = c.R[op & 0xF];
+  return 2;
+}
+
+int ghi(cdp1802 &c, uint8_t op) {
+  c.D = c.R[op & 0xF] >> 8;
+  return 2;
+}
+
+int plo(cdp1802 &c, uint8_t op) {
+  c.R[op & 0xF] = (c.R[op & 0xF] & 0xFF00) | c.D;
+  return 2;
+}
+
+int phi(cdp1802 &c, uint8_t op) {
+  c.R[op & 0xF] = (c.R[op & 0xF] & 0x00FF) | c.D << 8;
+  return 2;
+}
+
+// CN: long branches (C0-C3, C8-CB less C8) and skips; C4 is NOP
+int longBranch(cdp1802 &c, uint8_t op) {
+  int n = op & 0xF;
+  bool taken;
+  switch (n & 3) {
+  case (0):
+    taken = n == 0xC ? c.IE : true; // LBR, NLBR/LSKP, LSIE; C4 NOP below
+    break;
+  case (1):
+    taken = c.Q;
+    break;
+  case (2):
+    taken = c.D == 0;
+    break;
+  default:
+    taken = c.DF;
+    break;
+  }
+  if (n == 0x4) {
+    return 3; // NOP
+  }
+  bool skip = (n & 0x4) != 0 || n == 0x8; // C5-C7, C8, CC-CF
+  if (n >= 0x5 && n <= 0x7) {
+    taken = !taken; // LSNQ, LSNZ, LSNF
+  } else if (n >= 0x9 && n <= 0xB) {
+    taken = !taken; // LBNQ, LBNZ, LBNF
+  }
+  if (skip) {
+    if (taken) {
+      c.R[c.P] += 2;
+    }
+  } else if (taken) {
+    uint8_t hi = c.read(c.R[c.P]);
+    uint8_t lo = c.read(c.R[c.P] + 1);
+    c.R[c.P] = hi << 8 | lo;
+  } else {
+    c.R[c.P] += 2;
+  }
+  return 3;
+}
+
+int sep(cdp1802 &c, uint8_t op) {
+  c.P = op & 0xF;
+  return 2;
+}
+
+int sex(cdp1802 &c, uint8_t op) {
+  c.X = op & 0xF;
+  return 2;
+}
+
+// FN: ALU ops on M(R(X)), or on the immediate byte for F8-FF
+int alu(cdp1802 &c, uint8_t op) {
+  if (op == 0xF6 || op == 0xFE) { // SHR, SHL
+    if (op == 0xF6) {
+      c.DF = c.D & 1;
+      c.D >>= 1;
+    } else {
+      c.DF = c.D >> 7;
+      c.D <<= 1;
+    }
+    return 2;
+  }
+  uint8_t m = op & 0x8 ? c.next() : c.read(c.R[c.X]);
+  switch (op & 0x7) {
+  case (0): // LDX, LDI
+    c.D = m;
+    break;
+  case (1): // OR, ORI
+    c.D |= m;
+    break;
+  case (2): // AND, ANI
+    c.D &= m;
+    break;
+  case (3): // XOR, XRI
+    c.D ^= m;
+    break;
+  case (4): // ADD, ADI
+    add(c, m, c.D, 0);
+    break;
+  case (5): // SD, SDI
+    sub(c, m, c.D, 0);
+    break;
+  default: // 7: SM, SMI
+    sub(c, c.D, m, 0);
+    break;
+  }
+  return 2;
+}
+
+struct dispatchTable {
+  handler op[256];
+  constexpr dispatchTable() : op() {
+    for (int i = 0; i < 256; i++) {
+      switch (i >> 4) {
+      case (0x0):
+        op[i] = i == 0 ? idl : ldn;
+        break;
+      case (0x1):
+        op[i] = inc;
+        break;
+      case (0x2):
+        op[i] = dec;
+        break;
+      case (0x3):
+        op[i] = shortBranch;
+        break;
+      case (0x4):
+        op[i] = lda;
+        break;
+      case (0x5):
+        op[i] = str;
+        break;
+      case (0x6):
+        op[i] = i == 0x60 ? irx : i < 0x68 ? out : i == 0x68 ? nop : inp;
+        break;
+      case (0x7):
+        op[i] = i <= 0x71 ? ret : misc;
+        break;
+      case (0x8):
+        op[i] = glo;
+        break;
+      case (0x9):
+        op[i] = ghi;
+        break;
+      case (0xA):
+        op[i] = plo;
+        break;
+      case (0xB):
+        op[i] = phi;
+        break;
+      case (0xC):
+        op[i] = longBranch;
+        break;
+      case (0xD):
+        op[i] = sep;
+        break;
+      case (0xE):
+        op[i] = sex;
+        break;
+      default:
+        op[i] = alu;
+        break;
+      }
+    }
+  }
+};
+
+constexpr dispatchTable dispatch;
+
+} // namespace
+
+void cdp1802::reset() {
+  for (int i = 0; i < 16; i++) {
+    R[i] = 0;
+  }
+  D = 0;
+  P = 0;
+  X = 0;
+  T = 0;
+  DF = false;
+  IE = true;
+  Q = false;
+  idle = false;
+  ef = 0;
+  inData = 0;
+  io = {0, false, 0};
+}
+
+void cdp1802::interrupt() {
+  T = X << 4 | P;
+  P = 1;
+  X = 2;
+  IE = false;
+  idle = false;
+}
+
+uint8_t cdp1802::dmaOut() {
+  idle = false;
+  return read(R[0]++);
+}
+
+int cdp1802::execute() {
+  uint8_t op = next();
+  return dispatch.op[op](*this, op);
+}
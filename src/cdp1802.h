@@ -0,0 +1,48 @@
+#pragma once
+#include <cstdint>
+
+// RCA CDP1802, as wired in the COSMAC VIP: 4K of RAM at 0x0000, mirrored
+// up to 0x7FFF, and the 512 byte monitor ROM from 0x8000. Instructions are
+// dispatched through a 256 entry table of handlers, each returning the
+// machine cycles it took (2, or 3 for the long branches and skips).
+//
+// I/O is left to the machine around the core: OUT and INP record the port
+// they strobed in io, the machine acts on it between instructions and sets
+// the EF flag inputs.
+class cdp1802 {
+public:
+  struct ioEvent {
+    uint8_t port; // 1-7, 0 = none since the last clear
+    bool input;   // INP rather than OUT
+    uint8_t data; // byte written by OUT
+  };
+
+  uint16_t R[16];
+  uint8_t D, P, X, T;
+  bool DF, IE, Q;
+  bool idle;  // IDL: waiting for DMA or an interrupt
+  uint8_t ef; // EF1-EF4 inputs, bit n - 1 for EFn
+  uint8_t inData; // what INP reads from the bus
+  ioEvent io;
+  uint8_t *ram;       // 4096 bytes
+  const uint8_t *rom; // 512 bytes
+
+  // Power-on state: P, X and R0 zero, interrupts enabled
+  void reset();
+  // Takes an interrupt: T = XP, then X = 2 and P = 1 with interrupts off
+  void interrupt();
+  // One DMA output cycle: the byte at R0, which advances
+  uint8_t dmaOut();
+  // Runs one instruction and returns its machine cycles
+  int execute();
+
+  uint8_t read(uint16_t addr) const {
+    return addr & 0x8000 ? rom[addr & 0x1FF] : ram[addr & 0xFFF];
+  }
+  void write(uint16_t addr, uint8_t value) {
+    if (!(addr & 0x8000)) {
+      ram[addr & 0xFFF] = value;
+    }
+  }
+  uint8_t next() { return read(R[P]++); } // immediate byte
+};
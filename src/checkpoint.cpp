@@ -0,0 +1,99 @@
+#include "checkpoint.h"
+#include "log.h"
+#include <cerrno>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+
+void checkpointWriter::start(const char *checkpointPath) {
+  path = checkpointPath;
+  stopping = false;
+  failed = false;
+  thread = std::thread([this] { run(); });
+}
+
+void checkpointWriter::submit(std::vector<char> &&image) {
+  {
+    std::lock_guard<std::mutex> guard(mutex);
+    pending.swap(image);
+    hasPending = true;
+  }
+  cond.notify_one();
+}
+
+bool checkpointWriter::stop() {
+  if (thread.joinable()) {
+    {
+      std::lock_guard<std::mutex> guard(mutex);
+      stopping = true;
+    }
+    cond.notify_one();
+    thread.join();
+  }
+  return !failed;
+}
+
+void checkpointWriter::run() {
+  std::vector<char> image;
+  std::unique_lock<std::mutex> guard(mutex);
+  while (true) {
+    cond.wait(guard, [this] { return hasPending || stopping; });
+    if (!hasPending) {
+      break; // stopping with nothing left to write
+    }
+    image.swap(pending);
+    hasPending = false;
+    guard.unlock();
+    if (!write(image)) {
+      failed = true;
+    }
+    guard.lock();
+  }
+}
+
+bool checkpointWriter::write(const std::vector<char> &image) {
+  std::string tmp = path + ".tmp";
+  int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    LOG_ERROR("checkpoint_open_failed", "path", tmp.c_str(), "errno", errno);
+    return false;
+  }
+  size_t done = 0;
+  while (done < image.size()) {
+    ssize_t n = ::write(fd, image.data() + done, image.size() - done);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      LOG_ERROR("checkpoint_write_failed", "path", tmp.c_str(), "errno",
+                errno);
+      close(fd);
+      return false;
+    }
+    done += n;
+  }
+  bool ok = fdatasync(fd) == 0;
+  ok = close(fd) == 0 && ok;
+  if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+    LOG_ERROR("checkpoint_commit_failed", "path", path.c_str(), "errno",
+              errno);
+    return false;
+  }
+  return true;
+}
+
+bool readCheckpoint(const char *path, std::vector<char> &image) {
+  FILE *file = fopen(path, "rb");
+  if (file == NULL) {
+    return false;
+  }
+  image.clear();
+  char buf[65536];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), file)) > 0) {
+    image.insert(image.end(), buf, buf + n);
+  }
+  bool ok = !ferror(file);
+  fclose(file);
+  return ok;
+}
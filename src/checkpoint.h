@@ -0,0 +1,39 @@
+#pragma once
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Writes checkpoint images on a background thread so the caller never
+// waits on the disk. Images are batched: submitting while a write is in
+// flight replaces any image still waiting, so a burst of progress costs one
+// write. Each image is written to PATH.tmp, synced and renamed over PATH,
+// so a crash mid-write leaves the previous checkpoint intact.
+class checkpointWriter {
+private:
+  std::string path;
+  std::thread thread;
+  std::mutex mutex;
+  std::condition_variable cond;
+  std::vector<char> pending;
+  bool hasPending;
+  bool stopping;
+  bool failed;
+
+  void run();
+  bool write(const std::vector<char> &image);
+
+public:
+  checkpointWriter() : hasPending(false), stopping(false), failed(false) {}
+  ~checkpointWriter() { stop(); }
+
+  void start(const char *checkpointPath);
+  void submit(std::vector<char> &&image);
+  // Writes the last submitted image, if any, and joins the thread. Returns
+  // false if any write failed.
+  bool stop();
+};
+
+// Reads a whole checkpoint file; false if it does not exist
+bool readCheckpoint(const char *path, std::vector<char> &image);
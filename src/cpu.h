@@ -1,31 +1,564 @@
 #pragma once
 // unsigned short 2bytes
 // unsigned char 1byte
+#include "log.h"
+#include <cstddef>
 #include <cstdint>
+#include <type_traits>
+
+// The interpreter core is constexpr, so short programs can run at compile
+// time: its executed path uses no SDL, libc or heap, and logging is skipped
+// during constant evaluation. That is why it is defined here rather than in
+// cpu.cpp.
+
+enum quirkProfile { PROFILE_VIP, PROFILE_SCHIP, PROFILE_XOCHIP };
+
+struct quirkConfig {
+  bool displayWait = true; // DXYN waits for the next vblank (VIP)
+
+  bool operator==(const quirkConfig &) const = default;
+};
+
+constexpr quirkConfig quirksFor(quirkProfile profile) {
+  quirkConfig q;
+  switch (profile) {
+  case (PROFILE_VIP):
+    q.displayWait = true;
+    break;
+  case (PROFILE_SCHIP):
+  case (PROFILE_XOCHIP):
+    q.displayWait = false;
+    break;
+  }
+  return q;
+}
+
+// Memory access hooks for cpu::step. Every hook is an empty inline so the
+// plain interpreter (executeCycle) compiles exactly as if they weren't there.
+struct noHooks {
+  constexpr void onExecute(uint16_t) {}
+  constexpr void onRead(uint16_t) {}
+  constexpr void onWrite(uint16_t) {}
+};
+
+inline constexpr uint8_t chip8_fontset[80] = {
+    0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
+    0x20, 0x60, 0x20, 0x20, 0x70, // 1
+    0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
+    0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
+    0x90, 0x90, 0xF0, 0x10, 0x10, // 4
+    0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
+    0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
+    0xF0, 0x10, 0x20, 0x40, 0x40, // 7
+    0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
+    0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
+    0xF0, 0x90, 0xF0, 0x90, 0x90, // A
+    0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
+    0xF0, 0x80, 0x80, 0x80, 0xF0, // C
+    0xE0, 0x90, 0x90, 0x90, 0xE0, // D
+    0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
+    0xF0, 0x80, 0xF0, 0x80, 0x80  // F
+};
 
 class cpu {
 private:
-  uint16_t opcode;
-  uint8_t memory[4096];
-  uint16_t I;          // Index Register
-  uint16_t pc;         // Program Counter
-  uint8_t delay_timer; // used for events (counts down at 60Hz)
-  uint8_t sound_timer; // plays sound when >0 (counts down at 60Hz)
-  uint16_t stack[16];
-  uint16_t sp; // Stack Pointer
+  uint16_t opcode = 0;
+  uint8_t memory[4096] = {};
+  uint16_t I = 0;          // Index Register
+  uint16_t pc = 0x200;     // Program Counter
+  uint8_t delay_timer = 0; // used for events (counts down at 60Hz)
+  uint8_t sound_timer = 0; // plays sound when >0 (counts down at 60Hz)
+  uint16_t stack[16] = {};
+  uint16_t sp = 0;              // Stack Pointer
+  bool vblankWait = false;      // DXYN stalled waiting for vblank
+  bool vblankInterrupt = false; // vblank arrived while DXYN was stalled
+  uint32_t rng = 1; // CXNN generator state, part of the machine state
 
 public:
-  uint8_t gfx[64 * 32]; // Pixel State (graphics)
-  uint8_t key[16];      // State of keys 0-F
-  uint8_t prevKeys[16]; // State of keys in previous frame
-  bool running;
-  void init();
+  uint8_t gfx[64 * 32] = {}; // Pixel State (graphics)
+  uint8_t key[16] = {};      // State of keys 0-F
+  uint8_t prevKeys[16] = {}; // State of keys in previous frame
+  bool running = false;
+  uint16_t badOpcode = 0; // set when running stops on an unknown opcode
+  quirkConfig quirks;
+  constexpr void init();
+  constexpr void seed(uint32_t value);
   bool loadRom(const char *romName);
-  void executeCycle();
-  bool breakIPF;
-  bool draw;
-  void keyDown(int pressedKey);
-  void keyUp(int pressedKey);
-  bool timers();
-  uint8_t V[16]; // Registers V0-VE
+  constexpr bool loadRom(const uint8_t *rom, size_t size);
+  constexpr uint8_t readMemory(uint16_t addr) const {
+    return memory[addr & 0xFFF];
+  }
+  constexpr uint16_t getPC() const { return pc; }
+  constexpr void executeCycle();
+  template <class hooks>
+  constexpr void step(hooks &h); // executeCycle with hooks
+  bool breakIPF = false;
+  bool keyWait = false; // last instruction was FX0A still waiting for a key
+  bool draw = false;
+  constexpr void keyDown(int pressedKey) { key[pressedKey] = 1; }
+  constexpr void keyUp(int pressedKey) { key[pressedKey] = 0; }
+  constexpr bool timers();
+  constexpr void vblank();
+  constexpr bool runFrame(int ipf);
+  template <class hooks> constexpr bool runFrame(int ipf, hooks &h);
+  uint8_t V[16] = {}; // Registers V0-VE
+  friend class debugger;
+  friend class stateCodec;
+  friend class subroutineMemo;
+  friend class irRunner;
+  friend class vipClock;
+  friend class vipCompare;
 };
+
+// define nibbles
+#define OP_X ((opcode & 0x0F00) >> 8)
+#define OP_Y ((opcode & 0x00F0) >> 4)
+#define OP_N (opcode & 0x000F)
+#define OP_NN (opcode & 0x00FF)
+#define OP_NNN (opcode & 0x0FFF)
+
+constexpr void cpu::init() {
+  pc = 0x200;   // Program Counter to start of program
+  opcode = 0x00; // Reset current opcode
+  I = 0;         // Reset index register
+  sp = 0;        // Reset stack pointer
+  for (int i = 0; i < 4096; i++) {
+    memory[i] = 0; // Clear memory
+  }
+  for (int i = 0; i < 16; i++) {
+    stack[i] = 0;    // Clear stack
+    key[i] = 0;      // Reset keys
+    prevKeys[i] = 0; // Reset Prevkeys
+  }
+  for (int i = 0; i < 64 * 32; i++) {
+    gfx[i] = 0; // Reset display
+  }
+
+  // Load font into memory
+  for (int i = 0; i < 80; i++) {
+    memory[i] = chip8_fontset[i];
+  }
+  breakIPF = false;
+  draw = false;
+  running = true;
+  badOpcode = 0;
+  vblankWait = false;
+  vblankInterrupt = false;
+  quirks = quirksFor(PROFILE_VIP);
+  seed(1);
+}
+
+// CXNN draws from the cpu's own generator so runs replay deterministically
+constexpr void cpu::seed(uint32_t value) { rng = value ? value : 0x2545F491; }
+
+constexpr bool cpu::loadRom(const uint8_t *rom, size_t size) {
+  if (size > sizeof(memory) - 0x200) {
+    return false;
+  }
+  for (size_t i = 0; i < size; i++) {
+    memory[0x200 + i] = rom[i];
+  }
+  return true;
+}
+
+template <class hooks> constexpr void cpu::step(hooks &h) {
+  // fetch
+  breakIPF = false; // reset breakloop
+  keyWait = false;
+  h.onExecute(pc);
+  opcode = memory[pc & 0xFFF] << 8 | memory[(pc + 1) & 0xFFF];
+  if (!std::is_constant_evaluated()) {
+    LOG_TRACE("exec", "pc", logging::hex(pc), "op", logging::hex(opcode));
+  }
+  pc += 2;
+
+  // decode & execute
+  switch (opcode & 0xF000) {
+  case (0x0000): {
+    switch (opcode & 0x000F) {
+    case (0x0): // 00E0: Clear Screen
+      for (int i = 0; i < 64 * 32; i++) {
+        gfx[i] = 0;
+      }
+      draw = true;
+      break;
+    case (0xE): // 00EE: return from subroutine
+      sp = (sp - 1) & 0xF;
+      pc = stack[sp];
+      break;
+    }
+    break;
+  }
+  case (0x1000): // 1NNN: jump to NNN
+  {
+    pc = OP_NNN;
+    break;
+  }
+  case (0x2000): // 2NNN: jump to NNN, push PC to stack
+  {
+    stack[sp] = pc;
+    sp = (sp + 1) & 0xF;
+    pc = OP_NNN;
+    break;
+  }
+  case (0x3000): // 3XNN: skip instruction if VX == NN
+  {
+    if (V[OP_X] == OP_NN) {
+      pc += 2;
+    }
+    break;
+  }
+
+  case (0x4000): // 4XNN: skip instruction if VX != NN
+  {
+    if (V[OP_X] != OP_NN) {
+      pc += 2;
+    }
+    break;
+  }
+
+  case (0x5000): // 5XY0: skip instruction if VX == VY
+  {
+    if (V[OP_X] == V[OP_Y]) {
+      pc += 2;
+    }
+    break;
+  }
+  case (0x6000): // 6XNN: set V[X] to NN;
+  {
+    V[OP_X] = OP_NN;
+    break;
+  }
+  case (0x7000): // 7XNN: V[X] += NNk
+  {
+    V[OP_X] += OP_NN;
+    break;
+  }
+
+  case (0x8000): // Logic functions
+  {
+    switch (opcode & 0x000F) {
+    case (0x0): // 8XY0: VX = VY
+    {
+      V[OP_X] = V[OP_Y];
+      break;
+    }
+    case (0x1): // 8XY1: VX |= VY
+    {
+      V[OP_X] |= V[OP_Y];
+      V[0xF] = 0;
+      break;
+    }
+    case (0x2): // 8XY2: VX &= VY
+    {
+      V[OP_X] &= V[OP_Y];
+      V[0xF] = 0;
+      break;
+    }
+    case (0x3): // 8XY3: VX ^= VY
+    {
+      V[OP_X] ^= V[OP_Y];
+      V[0xF] = 0;
+      break;
+    }
+
+    case (0x4): // 8XY4: VX += VY (carry flag VF)
+    {
+      int x = V[OP_X] + V[OP_Y];
+      V[OP_X] += V[OP_Y];
+      V[0xF] = (x > 255) ? 1 : 0;
+      break;
+    }
+
+    case (0x5): // 8XY5: VX -= VY
+    {
+      uint16_t temp = (V[OP_X] >= V[OP_Y]) ? 1 : 0;
+      V[OP_X] -= V[OP_Y];
+      V[0xF] = temp;
+      break;
+    }
+    case (0x6): // AMBIGUOUS! 8XY6: VX = VY, VX >> 1, VF = bitshifted num
+    {
+      uint16_t temp = (V[OP_X] & 0b1);
+      V[OP_X] = V[OP_Y];
+      V[OP_X] >>= 1;
+      V[0xF] = temp;
+      break;
+    }
+
+    case (0x7): // 8XY7: VX = VY - VX
+    {
+      uint16_t temp = (V[OP_X] <= V[OP_Y]) ? 1 : 0;
+      V[OP_X] = V[OP_Y] - V[OP_X];
+      V[0xF] = temp;
+      break;
+    }
+
+    case (0xE): // AMBIGUOUS! 8XYE: VX = VY, VX << 1, VF = bitshifted num
+    {
+      V[OP_X] = V[OP_Y];
+      uint16_t temp = (((V[OP_X] & 0x80) >> 7) & 0b1);
+      V[OP_X] <<= 1;
+      V[0xF] = temp;
+      break;
+    }
+    }
+    break;
+  }
+
+  case (0x9000): { // 9XY0: skip insturction if VX != VY
+    if (V[OP_X] != V[OP_Y]) {
+      pc += 2;
+    }
+    break;
+  }
+
+  case (0xA000): // ANNN: I = NNN
+  {
+    I = OP_NNN;
+    break;
+  }
+
+  case (0xB000): { // BNNN: PC = V0 + NNN
+    pc = OP_NNN + V[0x0];
+    break;
+  }
+
+  case (0xC000): { // CXNN: VX = rand() & NN
+    rng ^= rng << 13; // xorshift32
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    int randNum = (rng >> 8) & 0xFF;
+    V[OP_X] = randNum & OP_NN;
+    break;
+  }
+
+  case (0xD000): // DXYN: Display V[X] = xpos, V[Y] = ypos, N = height
+  {
+    // VIP: sprite is drawn after the next vblank interrupt, not immediately
+    if (quirks.displayWait) {
+      if (!vblankInterrupt) {
+        vblankWait = true;
+        breakIPF = true;
+        pc -= 2;
+        return;
+      }
+      vblankInterrupt = false;
+    }
+    // CLIPPING : OFF
+    uint16_t x = V[OP_X] % 64;
+    uint16_t y = V[OP_Y] % 32;
+    uint16_t n = OP_N;
+    uint16_t pixel = 0;
+    V[0xF] = 0;
+    for (int height = 0; height < n; height++) {
+      if (y + height > 32) {
+        continue;
+      }
+      h.onRead(I + height);
+      pixel = memory[(I + height) & 0xFFF];
+      for (int bit = 0; bit < 8; bit++) {
+        if (x + bit > 64) {
+          continue;
+        }
+        if ((pixel & (0x80 >> bit)) != 0) {
+          uint16_t drawX = (x + bit) % 64;
+          uint16_t drawY = (y + height) % 32;
+          uint16_t index = drawX + (drawY * 64);
+          if (gfx[index] == 1) {
+            V[0xF] = 1;
+          }
+          gfx[index] ^= 1;
+        }
+      }
+    }
+    draw = true;
+    break;
+  }
+
+    // CLIPPING : ON
+    // uint16_t x = V[OP_X];
+    // uint16_t y = V[OP_Y];
+    // uint16_t n = OP_N;
+    // uint16_t pixel = 0;
+    // V[0xF] = 0;
+    //
+    // for (int height = 0; height < n; height++) {
+    //   if (y + height >= 32) { // Clip vertically
+    //     break;
+    //   }
+    //   pixel = memory[I + height];
+    //   for (int bit = 0; bit < 8; bit++) {
+    //     if (x + bit >= 64) { // Clip horizontally
+    //       continue;
+    //     }
+    //     uint16_t drawX = x + bit;
+    //     uint16_t drawY = y + height;
+    //     uint16_t index = drawX + (drawY * 64);
+    //
+    //     if ((pixel & (0x80 >> bit)) != 0) {
+    //       if (gfx[index] == 1) {
+    //         V[0xF] = 1; // Set collision flag
+    //       }
+    //       gfx[index] ^= 1; // Toggle the pixel
+    //     }
+    //   }
+    // }
+    // breakIPF = true;
+    // break;
+    //
+
+  case (0xE000): {
+    switch (opcode & 0x00FF) {
+    case (0x9E): { // EX9E: skip next instructin if button in VX pressed
+      if (key[V[OP_X]] != 0) {
+        pc += 2;
+      }
+      break;
+    }
+    case (0xA1): { // EXA1: skip instruction if button in VX NOT pressed
+      if (key[V[OP_X]] == 0) {
+        pc += 2;
+      }
+      break;
+    }
+    }
+    break;
+  }
+
+  case (0xF000): {
+    switch (opcode & 0x00FF) {
+    case (0x0A): { // FX0A: Vx = get_key()
+      bool keyReleased = false;
+      for (int i = 0; i < 16; i++) {
+        if (prevKeys[i] == 1 && key[i] == 0) {
+          V[OP_X] = i;
+          prevKeys[i] = 0; // consume release so a re-run FX0A waits again
+          keyReleased = true;
+          break;
+        }
+      }
+      if (!keyReleased) {
+        pc -= 2;
+        keyWait = true;
+        return;
+      }
+      break;
+    }
+    case (0x07): { // FX07: VX = delay_timer
+      V[OP_X] = delay_timer;
+      break;
+    }
+    case (0x15): { // FX15: delay_timer = VX
+      delay_timer = V[OP_X];
+      break;
+    }
+    case (0x18): { // FX18: sound_timer = VX
+      sound_timer = V[OP_X];
+      break;
+    }
+    case (0x1E): { // FX1E: I += VX
+      I += V[OP_X];
+      break;
+    }
+    case (0x29): {
+      I = (V[OP_X] * 0x5);
+      break;
+    }
+
+    case (0x33): { // FX33: Binary-coded decimal conversion
+      int hundreds = 0, tens = 0, ones = 0;
+      int number = V[OP_X];
+      hundreds = number / 100;
+      tens = (number / 10) % 10;
+      ones = number % 10;
+      h.onWrite(I);
+      h.onWrite(I + 1);
+      h.onWrite(I + 2);
+      memory[I & 0xFFF] = hundreds;
+      memory[(I + 1) & 0xFFF] = tens;
+      memory[(I + 2) & 0xFFF] = ones;
+      break;
+    }
+    case (0x55): { // FX55: store memory from V0 to VX
+      for (int i = 0; i <= OP_X; i++) {
+        h.onWrite(I);
+        memory[I & 0xFFF] = V[i];
+        I++; // I gets incremented due to classic chip8 implementation
+      }
+      break;
+    }
+    case (0x65): { // FX65: store memory from V0 to VX
+      for (int i = 0; i <= OP_X; i++) {
+        h.onRead(I);
+        V[i] = memory[I & 0xFFF];
+        I++; // I gets incremented due to classic chip8 implementation
+      }
+      break;
+    }
+    }
+    break;
+  }
+  default: {
+    badOpcode = opcode; // reported by the frontend
+    if (!std::is_constant_evaluated()) {
+      LOG_DEBUG("bad_opcode", "pc", logging::hex(pc - 2),
+                "op", logging::hex(opcode));
+    }
+    running = false;
+  }
+  }
+}
+
+constexpr void cpu::executeCycle() {
+  noHooks h;
+  step(h);
+}
+
+constexpr bool cpu::timers() {
+  if (sound_timer > 0) {
+    sound_timer--;
+  }
+  if (delay_timer > 0) {
+    delay_timer--;
+  }
+  return (sound_timer > 0);
+}
+
+// Called at the start of each 60Hz frame; releases a DXYN stalled on it
+constexpr void cpu::vblank() {
+  vblankInterrupt = vblankWait;
+  vblankWait = false;
+}
+
+// One 60Hz frame: vblank, up to ipf instructions, then the timers.
+// Returns true while sound should play.
+template <class hooks> constexpr bool cpu::runFrame(int ipf, hooks &h) {
+  vblank();
+  for (int i = 0; i < ipf; i++) {
+    step(h);
+    if (breakIPF || !running) {
+      break;
+    }
+  }
+  return timers();
+}
+
+constexpr bool cpu::runFrame(int ipf) {
+  noHooks h;
+  return runFrame(ipf, h);
+}
+
+#undef OP_X
+#undef OP_Y
+#undef OP_N
+#undef OP_NN
+#undef OP_NNN
+
+// Power-on state (font loaded, pc at 0x200) built at compile time
+constexpr cpu makeBootState() {
+  cpu c;
+  c.init();
+  return c;
+}
+inline constexpr cpu BOOT_STATE = makeBootState();
@@ -0,0 +1,243 @@
+#include "debugger.h"
+#include "log.h"
+#include <cstdlib>
+#include <cstring>
+
+void debugger::init() {
+  breakpoints.clear();
+  watchpoints.clear();
+  memset(breakAt, 0, sizeof(breakAt));
+  memset(watchAt, 0, sizeof(watchAt));
+  stopped = false;
+  resuming = false;
+  singleStep = false;
+  frameDone = true;
+  executed = 0;
+  reason = STOP_NONE;
+  stopAddr = 0;
+}
+
+void debugger::addBreakpoint(uint16_t addr) {
+  breakpoint bp = {(uint16_t)(addr & 0xFFF), false, 0, CMP_EQ, 0};
+  breakpoints.push_back(bp);
+  breakAt[bp.addr] = 1;
+}
+
+void debugger::addConditionalBreakpoint(uint16_t addr, uint8_t reg,
+                                        breakCompare cmp, uint8_t value) {
+  breakpoint bp = {(uint16_t)(addr & 0xFFF), true, (uint8_t)(reg & 0xF), cmp,
+                   value};
+  breakpoints.push_back(bp);
+  breakAt[bp.addr] = 1;
+}
+
+void debugger::removeBreakpoint(uint16_t addr) {
+  addr &= 0xFFF;
+  for (size_t i = 0; i < breakpoints.size();) {
+    if (breakpoints[i].addr == addr) {
+      breakpoints.erase(breakpoints.begin() + i);
+    } else {
+      i++;
+    }
+  }
+  breakAt[addr] = 0;
+}
+
+void debugger::addWatchpoint(uint16_t lo, uint16_t hi, int kind) {
+  watchpoint wp = {(uint16_t)(lo & 0xFFF), (uint16_t)(hi & 0xFFF), kind};
+  watchpoints.push_back(wp);
+  for (int addr = wp.lo; addr <= wp.hi; addr++) {
+    watchAt[addr] |= kind;
+  }
+}
+
+void debugger::stop(stopReason why, uint16_t addr) {
+  stopped = true;
+  reason = why;
+  stopAddr = addr;
+}
+
+void debugger::resume() {
+  stopped = false;
+  resuming = true;
+  reason = STOP_NONE;
+}
+
+void debugger::stepInstruction() {
+  resume();
+  singleStep = true;
+}
+
+bool debugger::breakpointHit(const cpu &c) const {
+  if (!breakAt[c.pc & 0xFFF]) {
+    return false;
+  }
+  for (size_t i = 0; i < breakpoints.size(); i++) {
+    const breakpoint &bp = breakpoints[i];
+    if (bp.addr != (c.pc & 0xFFF)) {
+      continue;
+    }
+    if (!bp.conditional) {
+      return true;
+    }
+    uint8_t v = c.V[bp.reg];
+    switch (bp.cmp) {
+    case (CMP_EQ):
+      if (v == bp.value) {
+        return true;
+      }
+      break;
+    case (CMP_NE):
+      if (v != bp.value) {
+        return true;
+      }
+      break;
+    case (CMP_LT):
+      if (v < bp.value) {
+        return true;
+      }
+      break;
+    case (CMP_GT):
+      if (v > bp.value) {
+        return true;
+      }
+      break;
+    }
+  }
+  return false;
+}
+
+bool debugger::step(cpu &c) {
+  if (stopped) {
+    return false;
+  }
+  if (!resuming && breakpointHit(c)) {
+    stop(STOP_BREAKPOINT, c.pc);
+    return false;
+  }
+  resuming = false;
+  c.step(*this);
+  if (singleStep) {
+    singleStep = false;
+    if (!stopped) {
+      stop(STOP_STEP, c.pc);
+    }
+  }
+  return true;
+}
+
+bool debugger::runFrame(cpu &c, int ipf) {
+  if (stopped) {
+    return false;
+  }
+  if (frameDone) {
+    c.vblank();
+    executed = 0;
+    frameDone = false;
+  }
+  while (executed < ipf) {
+    if (!step(c)) {
+      return false; // stopped before the instruction; resumes here
+    }
+    executed++;
+    bool endFrame = c.breakIPF || !c.running;
+    if (stopped) {
+      if (endFrame) {
+        executed = ipf;
+      }
+      return false; // stopped after the instruction
+    }
+    if (endFrame) {
+      break;
+    }
+  }
+  frameDone = true;
+  return c.timers();
+}
+
+void debugger::logState(const cpu &c) const {
+  static const char *reasons[] = {"", "breakpoint", "watchpoint", "step"};
+  uint16_t op = c.memory[c.pc & 0xFFF] << 8 | c.memory[(c.pc + 1) & 0xFFF];
+  char v[16 * 3];
+  for (int i = 0; i < 16; i++) {
+    snprintf(v + i * 3, 4, i < 15 ? "%02X " : "%02X", c.V[i]);
+  }
+  LOG_INFO("debugger_stopped", "reason", reasons[reason], "at",
+           logging::hex(stopAddr), "pc", logging::hex(c.pc), "op",
+           logging::hex(op), "I", logging::hex(c.I), "sp", c.sp, "V", v);
+}
+
+bool parseBreakpoint(debugger &dbg, const char *spec) {
+  char *end;
+  long addr = strtol(spec, &end, 0);
+  if (end == spec || addr < 0 || addr > 0xFFF) {
+    return false;
+  }
+  if (*end == '\0') {
+    dbg.addBreakpoint(addr);
+    return true;
+  }
+  // ADDR:VX<cmp>NN
+  if (end[0] != ':' || (end[1] != 'V' && end[1] != 'v')) {
+    return false;
+  }
+  const char regName[2] = {end[2], '\0'};
+  const char *p = end + 3;
+  long reg = strtol(regName, &end, 16);
+  if (end != regName + 1) {
+    return false;
+  }
+
+  breakCompare cmp;
+  if (strncmp(p, "==", 2) == 0) {
+    cmp = CMP_EQ;
+    p += 2;
+  } else if (strncmp(p, "!=", 2) == 0) {
+    cmp = CMP_NE;
+    p += 2;
+  } else if (*p == '<') {
+    cmp = CMP_LT;
+    p++;
+  } else if (*p == '>') {
+    cmp = CMP_GT;
+    p++;
+  } else {
+    return false;
+  }
+  long value = strtol(p, &end, 0);
+  if (end == p || *end != '\0' || value < 0 || value > 0xFF) {
+    return false;
+  }
+  dbg.addConditionalBreakpoint(addr, reg, cmp, value);
+  return true;
+}
+
+bool parseWatchpoint(debugger &dbg, const char *spec) {
+  char *end;
+  long lo = strtol(spec, &end, 0);
+  if (end == spec || lo < 0 || lo > 0xFFF) {
+    return false;
+  }
+  long hi = lo;
+  if (*end == '-') {
+    const char *p = end + 1;
+    hi = strtol(p, &end, 0);
+    if (end == p || hi < lo || hi > 0xFFF) {
+      return false;
+    }
+  }
+  int kind = WATCH_ACCESS;
+  if (*end == ':') {
+    if (strcmp(end + 1, "r") == 0) {
+      kind = WATCH_READ;
+    } else if (strcmp(end + 1, "w") == 0) {
+      kind = WATCH_WRITE;
+    } else if (strcmp(end + 1, "rw") != 0) {
+      return false;
+    }
+  } else if (*end != '\0') {
+    return false;
+  }
+  dbg.addWatchpoint(lo, hi, kind);
+  return true;
+}
@@ -0,0 +1,96 @@
+#pragma once
+#include "cpu.h"
+#include <cstdint>
+#include <vector>
+
+enum breakCompare { CMP_EQ, CMP_NE, CMP_LT, CMP_GT };
+enum watchKind { WATCH_READ = 1, WATCH_WRITE = 2, WATCH_ACCESS = 3 };
+enum stopReason { STOP_NONE, STOP_BREAKPOINT, STOP_WATCHPOINT, STOP_STEP };
+
+struct breakpoint {
+  uint16_t addr;
+  bool conditional; // only fires when V[reg] <cmp> value
+  uint8_t reg;
+  breakCompare cmp;
+  uint8_t value;
+};
+
+struct watchpoint {
+  uint16_t lo, hi; // inclusive range
+  int kind;        // watchKind bits
+};
+
+// Debugging engine that drives the cpu through cpu::step with itself as the
+// hook policy. The normal interpreter never sees it, so it costs nothing
+// unless a frontend chooses to run frames through the debugger.
+class debugger {
+private:
+  std::vector<breakpoint> breakpoints;
+  std::vector<watchpoint> watchpoints;
+  uint8_t breakAt[4096]; // fast pc check: any breakpoint at this address
+  uint8_t watchAt[4096]; // fast access check: watchKind bits per address
+  bool stopped;
+  bool resuming;   // skip the breakpoint at pc once after a stop
+  bool singleStep; // stop again after one instruction
+  bool frameDone;  // next runFrame starts a new frame
+  int executed;    // instructions run so far in the current frame
+  bool breakpointHit(const cpu &c) const;
+
+public:
+  stopReason reason;
+  uint16_t stopAddr; // pc for breakpoints, accessed address for watchpoints
+
+  void init();
+  void addBreakpoint(uint16_t addr);
+  void addConditionalBreakpoint(uint16_t addr, uint8_t reg, breakCompare cmp,
+                                uint8_t value);
+  void removeBreakpoint(uint16_t addr);
+  void addWatchpoint(uint16_t lo, uint16_t hi, int kind);
+  bool active() const { return !breakpoints.empty() || !watchpoints.empty(); }
+
+  bool isStopped() const { return stopped; }
+  // False while a frame stopped part way through is still to be finished
+  bool atFrameStart() const { return frameDone; }
+  void stop(stopReason why, uint16_t addr);
+  void resume();
+  void stepInstruction();
+
+  // Runs one instruction unless a breakpoint at pc fires first.
+  // Returns false if nothing was executed.
+  bool step(cpu &c);
+  // cpu::runFrame that can stop part way through and resume there later
+  bool runFrame(cpu &c, int ipf);
+  void logState(const cpu &c) const;
+
+  // cpu state access for frontends and remote debuggers
+  uint16_t getPC(const cpu &c) const { return c.pc; }
+  uint16_t getI(const cpu &c) const { return c.I; }
+  uint16_t getSP(const cpu &c) const { return c.sp; }
+  void setPC(cpu &c, uint16_t value) const { c.pc = value & 0xFFF; }
+  void setI(cpu &c, uint16_t value) const { c.I = value; }
+  void setSP(cpu &c, uint16_t value) const { c.sp = value & 0xF; }
+  uint8_t peek(const cpu &c, uint16_t addr) const {
+    return c.memory[addr & 0xFFF];
+  }
+  void poke(cpu &c, uint16_t addr, uint8_t value) const {
+    c.memory[addr & 0xFFF] = value;
+  }
+
+  // hook policy for cpu::step
+  void onExecute(uint16_t) {}
+  void onRead(uint16_t addr) {
+    if (watchAt[addr & 0xFFF] & WATCH_READ) {
+      stop(STOP_WATCHPOINT, addr & 0xFFF);
+    }
+  }
+  void onWrite(uint16_t addr) {
+    if (watchAt[addr & 0xFFF] & WATCH_WRITE) {
+      stop(STOP_WATCHPOINT, addr & 0xFFF);
+    }
+  }
+};
+
+// Parses "ADDR" or "ADDR:VX==NN" (also !=, <, >) into the debugger
+bool parseBreakpoint(debugger &dbg, const char *spec);
+// Parses "LO[-HI][:r|w|rw]" into the debugger
+bool parseWatchpoint(debugger &dbg, const char *spec);
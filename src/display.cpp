@@ -0,0 +1,154 @@
+#include "display.h"
+#include "displaykernels.h"
+#include <cstring>
+
+namespace {
+
+// Each mode is a single branch-free pass over the display so the compiler
+// can vectorize it; 2KB per frame is negligible next to the texture upload.
+void scalarComposeOff(const uint8_t *gfx, uint8_t *intensity) {
+  for (int i = 0; i < DISPLAY_SIZE; i++) {
+    intensity[i] = gfx[i] ? 255 : 0;
+  }
+}
+
+bool scalarComposeDecay(const uint8_t *gfx, uint8_t *intensity,
+                        uint8_t decay) {
+  uint8_t residue = 0;
+  for (int i = 0; i < DISPLAY_SIZE; i++) {
+    uint8_t lit = gfx[i] ? 255 : 0;
+    uint8_t faded = (intensity[i] * decay) >> 8;
+    intensity[i] = lit | faded;
+    residue |= faded & ~lit;
+  }
+  return residue != 0;
+}
+
+bool scalarComposeOr(const uint8_t *gfx,
+                     const uint8_t (*history)[DISPLAY_SIZE],
+                     uint8_t *intensity) {
+  uint8_t residue = 0;
+  for (int i = 0; i < DISPLAY_SIZE; i++) {
+    uint8_t seen = gfx[i];
+    for (int f = 0; f < PHOSPHOR_FRAMES; f++) {
+      seen |= history[f][i];
+    }
+    intensity[i] = seen ? 255 : 0;
+    residue |= seen & ~gfx[i];
+  }
+  return residue != 0;
+}
+
+// Mixes the frame 8 bytes at a time; a false match would drop one changed
+// frame, so a full-width multiply/rotate mix is used rather than a checksum.
+uint64_t scalarHash(const uint8_t *intensity) {
+  uint64_t lanes[HASH_LANES];
+  for (int l = 0; l < HASH_LANES; l++) {
+    lanes[l] = l;
+  }
+  for (int i = 0; i < DISPLAY_SIZE; i += 8) {
+    uint64_t word;
+    memcpy(&word, &intensity[i], sizeof(word));
+    uint64_t &h = lanes[(i / 8) % HASH_LANES];
+    h ^= word * HASH_K1;
+    h = ((h << 31) | (h >> 33)) * HASH_K2;
+  }
+  return hashFold(lanes);
+}
+
+void scalarExpand(const uint8_t *intensity, void *pixels, int pitch) {
+  for (int y = 0; y < DISPLAY_HEIGHT; y++) {
+    uint32_t *row = (uint32_t *)((uint8_t *)pixels + y * pitch);
+    const uint8_t *src = &intensity[y * DISPLAY_WIDTH];
+    for (int x = 0; x < DISPLAY_WIDTH; x++) {
+      uint32_t v = src[x];
+      row[x] = (v << 24) | (v << 16) | (v << 8) | 0xFF;
+    }
+  }
+}
+
+const displayKernels SCALAR_KERNELS = {scalarComposeOff, scalarComposeDecay,
+                                       scalarComposeOr, scalarHash,
+                                       scalarExpand};
+
+const displayKernels *kernels = &SCALAR_KERNELS;
+
+} // namespace
+
+simdLevel selectDisplayKernels(simdLevel limit) {
+  simdLevel level = SIMD_SCALAR;
+  kernels = &SCALAR_KERNELS;
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  if (limit >= SIMD_AVX512 && __builtin_cpu_supports("avx512f") &&
+      __builtin_cpu_supports("avx512bw") &&
+      __builtin_cpu_supports("avx512dq")) {
+    level = SIMD_AVX512;
+    kernels = &AVX512_KERNELS;
+  } else if (limit >= SIMD_AVX2 && __builtin_cpu_supports("avx2")) {
+    level = SIMD_AVX2;
+    kernels = &AVX2_KERNELS;
+  } else if (limit >= SIMD_SSE2 && __builtin_cpu_supports("sse2")) {
+    level = SIMD_SSE2;
+    kernels = &SSE2_KERNELS;
+  }
+#endif
+  return level;
+}
+
+const char *simdName(simdLevel level) {
+  switch (level) {
+  case (SIMD_SSE2):
+    return "sse2";
+  case (SIMD_AVX2):
+    return "avx2";
+  case (SIMD_AVX512):
+    return "avx512";
+  default:
+    return "scalar";
+  }
+}
+
+bool parseSimdLevel(const char *name, simdLevel &level) {
+  for (int l = SIMD_SCALAR; l <= SIMD_AVX512; l++) {
+    if (strcmp(name, simdName((simdLevel)l)) == 0) {
+      level = (simdLevel)l;
+      return true;
+    }
+  }
+  return false;
+}
+
+void phosphor::init(phosphorMode newMode, uint8_t newDecay) {
+  mode = newMode;
+  decay = newDecay;
+  head = 0;
+  fading = false;
+  memset(history, 0, sizeof(history));
+  memset(intensity, 0, sizeof(intensity));
+}
+
+void phosphor::compose(const uint8_t *gfx) {
+  switch (mode) {
+  case (PHOSPHOR_OFF):
+    kernels->composeOff(gfx, intensity);
+    fading = false;
+    break;
+  case (PHOSPHOR_DECAY):
+    fading = kernels->composeDecay(gfx, intensity, decay);
+    break;
+  case (PHOSPHOR_OR):
+    fading = kernels->composeOr(gfx, history, intensity);
+    memcpy(history[head], gfx, DISPLAY_SIZE);
+    head = (head + 1) % PHOSPHOR_FRAMES;
+    break;
+  }
+}
+
+uint64_t hashDisplay(const uint8_t *intensity) {
+  return kernels->hash(intensity);
+}
+
+void expandPixels(const uint8_t *intensity, void *pixels, int pitch) {
+  kernels->expand(intensity, pixels, pitch);
+}
@@ -0,0 +1,47 @@
+#pragma once
+#include <cstdint>
+
+const int DISPLAY_WIDTH = 64;
+const int DISPLAY_HEIGHT = 32;
+const int DISPLAY_SIZE = DISPLAY_WIDTH * DISPLAY_HEIGHT;
+const int PHOSPHOR_FRAMES = 3; // frames OR'd together in PHOSPHOR_OR mode
+
+enum phosphorMode {
+  PHOSPHOR_OFF,   // intensity follows gfx directly
+  PHOSPHOR_DECAY, // lit pixels fade out over a few frames
+  PHOSPHOR_OR     // pixel is lit if it was lit in any of the last frames
+};
+
+// Blends recent frames to hide the flicker caused by DXYN XOR-erasing and
+// redrawing sprites. Produces one 0-255 intensity per pixel.
+class phosphor {
+private:
+  phosphorMode mode;
+  uint8_t decay;                                // DECAY: kept fraction /256
+  uint8_t history[PHOSPHOR_FRAMES][DISPLAY_SIZE]; // OR: previous frames
+  int head;                                     // OR: oldest history slot
+  bool fading; // some pixel is still lit only by history
+
+public:
+  uint8_t intensity[DISPLAY_SIZE]; // composited output
+  void init(phosphorMode newMode, uint8_t newDecay = 160);
+  void compose(const uint8_t *gfx);
+  bool active() const { return fading; } // needs redraw even if gfx unchanged
+};
+
+// 64-bit hash of a composited frame, used to skip presenting repeat frames
+uint64_t hashDisplay(const uint8_t *intensity);
+
+// Converts intensities into RGBA8888 rows for the streaming texture
+void expandPixels(const uint8_t *intensity, void *pixels, int pitch);
+
+enum simdLevel { SIMD_SCALAR, SIMD_SSE2, SIMD_AVX2, SIMD_AVX512 };
+
+// Switches compose, hashDisplay and expandPixels to the widest kernels this
+// cpu supports, capped at limit. Call once at startup, before any other
+// thread uses them; until then the scalar kernels are used. Returns the
+// level selected.
+simdLevel selectDisplayKernels(simdLevel limit = SIMD_AVX512);
+const char *simdName(simdLevel level);
+// Parses "scalar", "sse2", "avx2" or "avx512"
+bool parseSimdLevel(const char *name, simdLevel &level);
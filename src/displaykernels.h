@@ -0,0 +1,45 @@
+#pragma once
+#include "display.h"
+#include <cstdint>
+
+// One implementation of every display kernel. display.cpp holds the scalar
+// table and picks the active one at startup; displaysimd.cpp compiles the
+// same kernels with SSE2, AVX2 and AVX-512 intrinsics, each in functions
+// carrying their own target attribute, so the binary needs no -march flag.
+// All tables produce bit-identical results.
+struct displayKernels {
+  void (*composeOff)(const uint8_t *gfx, uint8_t *intensity);
+  // Return nonzero if any pixel is lit only by phosphor history
+  bool (*composeDecay)(const uint8_t *gfx, uint8_t *intensity,
+                       uint8_t decay);
+  bool (*composeOr)(const uint8_t *gfx,
+                    const uint8_t (*history)[DISPLAY_SIZE],
+                    uint8_t *intensity);
+  uint64_t (*hash)(const uint8_t *intensity);
+  void (*expand)(const uint8_t *intensity, void *pixels, int pitch);
+};
+
+// The display hash runs HASH_LANES independent multiply/rotate chains,
+// lane i taking 8-byte words i, i + HASH_LANES, ..., so that SIMD versions
+// can advance all lanes at once; the lanes are folded together at the end.
+const int HASH_LANES = 8;
+const uint64_t HASH_K1 = 0x9E3779B97F4A7C15ULL;
+const uint64_t HASH_K2 = 0xC2B2AE3D27D4EB4FULL;
+
+inline uint64_t hashFold(const uint64_t *lanes) {
+  uint64_t h = DISPLAY_SIZE;
+  for (int i = 0; i < HASH_LANES; i++) {
+    h ^= lanes[i];
+    h = ((h << 27) | (h >> 37)) * HASH_K1;
+  }
+  h ^= h >> 29;
+  h *= HASH_K2;
+  h ^= h >> 32;
+  return h;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+extern const displayKernels SSE2_KERNELS;
+extern const displayKernels AVX2_KERNELS;
+extern const displayKernels AVX512_KERNELS;
+#endif
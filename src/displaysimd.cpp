@@ -0,0 +1,307 @@
+#include "displaykernels.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+#define SSE2 __attribute__((target("sse2")))
+#define AVX2 __attribute__((target("avx2")))
+#define AVX512 __attribute__((target("avx512f,avx512bw,avx512dq")))
+
+namespace {
+
+// ---- SSE2: 16 pixels per step ----
+
+SSE2 inline __m128i sse2Lit(__m128i v) {
+  return _mm_xor_si128(_mm_cmpeq_epi8(v, _mm_setzero_si128()),
+                       _mm_set1_epi8(-1));
+}
+
+// a * k modulo 2^64 per lane, from 32x32->64 bit multiplies
+SSE2 inline __m128i sse2Mul64(__m128i a, uint64_t k) {
+  __m128i klo = _mm_set1_epi64x(k & 0xFFFFFFFF);
+  __m128i khi = _mm_set1_epi64x(k >> 32);
+  __m128i lolo = _mm_mul_epu32(a, klo);
+  __m128i cross = _mm_add_epi64(_mm_mul_epu32(_mm_srli_epi64(a, 32), klo),
+                                _mm_mul_epu32(a, khi));
+  return _mm_add_epi64(lolo, _mm_slli_epi64(cross, 32));
+}
+
+SSE2 void sse2ComposeOff(const uint8_t *gfx, uint8_t *intensity) {
+  for (int i = 0; i < DISPLAY_SIZE; i += 16) {
+    __m128i g = _mm_loadu_si128((const __m128i *)(gfx + i));
+    _mm_storeu_si128((__m128i *)(intensity + i), sse2Lit(g));
+  }
+}
+
+SSE2 bool sse2ComposeDecay(const uint8_t *gfx, uint8_t *intensity,
+                           uint8_t decay) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i d = _mm_set1_epi16(decay);
+  __m128i residue = zero;
+  for (int i = 0; i < DISPLAY_SIZE; i += 16) {
+    __m128i lit = sse2Lit(_mm_loadu_si128((const __m128i *)(gfx + i)));
+    __m128i v = _mm_loadu_si128((const __m128i *)(intensity + i));
+    __m128i lo =
+        _mm_srli_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(v, zero), d), 8);
+    __m128i hi =
+        _mm_srli_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(v, zero), d), 8);
+    __m128i faded = _mm_packus_epi16(lo, hi);
+    _mm_storeu_si128((__m128i *)(intensity + i), _mm_or_si128(lit, faded));
+    residue = _mm_or_si128(residue, _mm_andnot_si128(lit, faded));
+  }
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(residue, zero)) != 0xFFFF;
+}
+
+SSE2 bool sse2ComposeOr(const uint8_t *gfx,
+                        const uint8_t (*history)[DISPLAY_SIZE],
+                        uint8_t *intensity) {
+  const __m128i zero = _mm_setzero_si128();
+  __m128i residue = zero;
+  for (int i = 0; i < DISPLAY_SIZE; i += 16) {
+    __m128i g = _mm_loadu_si128((const __m128i *)(gfx + i));
+    __m128i seen = g;
+    for (int f = 0; f < PHOSPHOR_FRAMES; f++) {
+      seen = _mm_or_si128(
+          seen, _mm_loadu_si128((const __m128i *)(history[f] + i)));
+    }
+    _mm_storeu_si128((__m128i *)(intensity + i), sse2Lit(seen));
+    residue = _mm_or_si128(residue, _mm_andnot_si128(g, seen));
+  }
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(residue, zero)) != 0xFFFF;
+}
+
+// lanes 2j and 2j+1 live in acc[j]
+SSE2 uint64_t sse2Hash(const uint8_t *intensity) {
+  __m128i acc[4];
+  for (int j = 0; j < 4; j++) {
+    acc[j] = _mm_set_epi64x(2 * j + 1, 2 * j);
+  }
+  for (int i = 0; i < DISPLAY_SIZE; i += 64) {
+    for (int j = 0; j < 4; j++) {
+      __m128i w = _mm_loadu_si128((const __m128i *)(intensity + i + 16 * j));
+      __m128i h = _mm_xor_si128(acc[j], sse2Mul64(w, HASH_K1));
+      h = _mm_or_si128(_mm_slli_epi64(h, 31), _mm_srli_epi64(h, 33));
+      acc[j] = sse2Mul64(h, HASH_K2);
+    }
+  }
+  uint64_t lanes[HASH_LANES];
+  for (int j = 0; j < 4; j++) {
+    _mm_storeu_si128((__m128i *)(lanes + 2 * j), acc[j]);
+  }
+  return hashFold(lanes);
+}
+
+SSE2 void sse2Expand(const uint8_t *intensity, void *pixels, int pitch) {
+  const __m128i alpha = _mm_set1_epi32(0xFF);
+  for (int y = 0; y < DISPLAY_HEIGHT; y++) {
+    uint8_t *row = (uint8_t *)pixels + y * pitch;
+    const uint8_t *src = &intensity[y * DISPLAY_WIDTH];
+    for (int x = 0; x < DISPLAY_WIDTH; x += 16) {
+      __m128i v = _mm_loadu_si128((const __m128i *)(src + x));
+      __m128i lo = _mm_unpacklo_epi8(v, v); // vv words
+      __m128i hi = _mm_unpackhi_epi8(v, v);
+      __m128i *dst = (__m128i *)(row + 4 * x);
+      _mm_storeu_si128(dst, _mm_or_si128(_mm_unpacklo_epi16(lo, lo), alpha));
+      _mm_storeu_si128(dst + 1,
+                       _mm_or_si128(_mm_unpackhi_epi16(lo, lo), alpha));
+      _mm_storeu_si128(dst + 2,
+                       _mm_or_si128(_mm_unpacklo_epi16(hi, hi), alpha));
+      _mm_storeu_si128(dst + 3,
+                       _mm_or_si128(_mm_unpackhi_epi16(hi, hi), alpha));
+    }
+  }
+}
+
+// ---- AVX2: 32 pixels per step ----
+
+AVX2 inline __m256i avx2Lit(__m256i v) {
+  return _mm256_xor_si256(_mm256_cmpeq_epi8(v, _mm256_setzero_si256()),
+                          _mm256_set1_epi8(-1));
+}
+
+AVX2 inline __m256i avx2Mul64(__m256i a, uint64_t k) {
+  __m256i klo = _mm256_set1_epi64x(k & 0xFFFFFFFF);
+  __m256i khi = _mm256_set1_epi64x(k >> 32);
+  __m256i lolo = _mm256_mul_epu32(a, klo);
+  __m256i cross =
+      _mm256_add_epi64(_mm256_mul_epu32(_mm256_srli_epi64(a, 32), klo),
+                       _mm256_mul_epu32(a, khi));
+  return _mm256_add_epi64(lolo, _mm256_slli_epi64(cross, 32));
+}
+
+AVX2 void avx2ComposeOff(const uint8_t *gfx, uint8_t *intensity) {
+  for (int i = 0; i < DISPLAY_SIZE; i += 32) {
+    __m256i g = _mm256_loadu_si256((const __m256i *)(gfx + i));
+    _mm256_storeu_si256((__m256i *)(intensity + i), avx2Lit(g));
+  }
+}
+
+// unpack and pack both work within 128-bit halves, so byte order survives
+AVX2 bool avx2ComposeDecay(const uint8_t *gfx, uint8_t *intensity,
+                           uint8_t decay) {
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i d = _mm256_set1_epi16(decay);
+  __m256i residue = zero;
+  for (int i = 0; i < DISPLAY_SIZE; i += 32) {
+    __m256i lit = avx2Lit(_mm256_loadu_si256((const __m256i *)(gfx + i)));
+    __m256i v = _mm256_loadu_si256((const __m256i *)(intensity + i));
+    __m256i lo = _mm256_srli_epi16(
+        _mm256_mullo_epi16(_mm256_unpacklo_epi8(v, zero), d), 8);
+    __m256i hi = _mm256_srli_epi16(
+        _mm256_mullo_epi16(_mm256_unpackhi_epi8(v, zero), d), 8);
+    __m256i faded = _mm256_packus_epi16(lo, hi);
+    _mm256_storeu_si256((__m256i *)(intensity + i),
+                        _mm256_or_si256(lit, faded));
+    residue = _mm256_or_si256(residue, _mm256_andnot_si256(lit, faded));
+  }
+  return !_mm256_testz_si256(residue, residue);
+}
+
+AVX2 bool avx2ComposeOr(const uint8_t *gfx,
+                        const uint8_t (*history)[DISPLAY_SIZE],
+                        uint8_t *intensity) {
+  __m256i residue = _mm256_setzero_si256();
+  for (int i = 0; i < DISPLAY_SIZE; i += 32) {
+    __m256i g = _mm256_loadu_si256((const __m256i *)(gfx + i));
+    __m256i seen = g;
+    for (int f = 0; f < PHOSPHOR_FRAMES; f++) {
+      seen = _mm256_or_si256(
+          seen, _mm256_loadu_si256((const __m256i *)(history[f] + i)));
+    }
+    _mm256_storeu_si256((__m256i *)(intensity + i), avx2Lit(seen));
+    residue = _mm256_or_si256(residue, _mm256_andnot_si256(g, seen));
+  }
+  return !_mm256_testz_si256(residue, residue);
+}
+
+// lanes 0-3 in acc[0], 4-7 in acc[1]
+AVX2 uint64_t avx2Hash(const uint8_t *intensity) {
+  __m256i acc[2] = {_mm256_set_epi64x(3, 2, 1, 0),
+                    _mm256_set_epi64x(7, 6, 5, 4)};
+  for (int i = 0; i < DISPLAY_SIZE; i += 64) {
+    for (int j = 0; j < 2; j++) {
+      __m256i w =
+          _mm256_loadu_si256((const __m256i *)(intensity + i + 32 * j));
+      __m256i h = _mm256_xor_si256(acc[j], avx2Mul64(w, HASH_K1));
+      h = _mm256_or_si256(_mm256_slli_epi64(h, 31), _mm256_srli_epi64(h, 33));
+      acc[j] = avx2Mul64(h, HASH_K2);
+    }
+  }
+  uint64_t lanes[HASH_LANES];
+  _mm256_storeu_si256((__m256i *)lanes, acc[0]);
+  _mm256_storeu_si256((__m256i *)(lanes + 4), acc[1]);
+  return hashFold(lanes);
+}
+
+// v * 0x01010100 puts v in the top three bytes of each pixel
+AVX2 void avx2Expand(const uint8_t *intensity, void *pixels, int pitch) {
+  const __m256i spread = _mm256_set1_epi32(0x01010100);
+  const __m256i alpha = _mm256_set1_epi32(0xFF);
+  for (int y = 0; y < DISPLAY_HEIGHT; y++) {
+    uint8_t *row = (uint8_t *)pixels + y * pitch;
+    const uint8_t *src = &intensity[y * DISPLAY_WIDTH];
+    for (int x = 0; x < DISPLAY_WIDTH; x += 8) {
+      __m256i v = _mm256_cvtepu8_epi32(
+          _mm_loadl_epi64((const __m128i *)(src + x)));
+      v = _mm256_or_si256(_mm256_mullo_epi32(v, spread), alpha);
+      _mm256_storeu_si256((__m256i *)(row + 4 * x), v);
+    }
+  }
+}
+
+// ---- AVX-512 (F, BW, DQ): 64 pixels per step ----
+
+// GCC 12's unmasked AVX-512 intrinsics self-initialise their passthrough
+// operand, which trips -Wuninitialized once they are inlined.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+
+AVX512 inline __m512i avx512Lit(__m512i v) {
+  return _mm512_movm_epi8(_mm512_test_epi8_mask(v, v));
+}
+
+AVX512 void avx512ComposeOff(const uint8_t *gfx, uint8_t *intensity) {
+  for (int i = 0; i < DISPLAY_SIZE; i += 64) {
+    __m512i g = _mm512_loadu_si512(gfx + i);
+    _mm512_storeu_si512(intensity + i, avx512Lit(g));
+  }
+}
+
+AVX512 bool avx512ComposeDecay(const uint8_t *gfx, uint8_t *intensity,
+                               uint8_t decay) {
+  const __m512i zero = _mm512_setzero_si512();
+  const __m512i d = _mm512_set1_epi16(decay);
+  __m512i residue = zero;
+  for (int i = 0; i < DISPLAY_SIZE; i += 64) {
+    __m512i lit = avx512Lit(_mm512_loadu_si512(gfx + i));
+    __m512i v = _mm512_loadu_si512(intensity + i);
+    __m512i lo = _mm512_srli_epi16(
+        _mm512_mullo_epi16(_mm512_unpacklo_epi8(v, zero), d), 8);
+    __m512i hi = _mm512_srli_epi16(
+        _mm512_mullo_epi16(_mm512_unpackhi_epi8(v, zero), d), 8);
+    __m512i faded = _mm512_packus_epi16(lo, hi);
+    _mm512_storeu_si512(intensity + i, _mm512_or_si512(lit, faded));
+    residue = _mm512_or_si512(residue, _mm512_andnot_si512(lit, faded));
+  }
+  return _mm512_test_epi64_mask(residue, residue) != 0;
+}
+
+AVX512 bool avx512ComposeOr(const uint8_t *gfx,
+                            const uint8_t (*history)[DISPLAY_SIZE],
+                            uint8_t *intensity) {
+  __m512i residue = _mm512_setzero_si512();
+  for (int i = 0; i < DISPLAY_SIZE; i += 64) {
+    __m512i g = _mm512_loadu_si512(gfx + i);
+    __m512i seen = g;
+    for (int f = 0; f < PHOSPHOR_FRAMES; f++) {
+      seen = _mm512_or_si512(seen, _mm512_loadu_si512(history[f] + i));
+    }
+    _mm512_storeu_si512(intensity + i, avx512Lit(seen));
+    residue = _mm512_or_si512(residue, _mm512_andnot_si512(g, seen));
+  }
+  return _mm512_test_epi64_mask(residue, residue) != 0;
+}
+
+// all eight lanes in one register
+AVX512 uint64_t avx512Hash(const uint8_t *intensity) {
+  const __m512i k1 = _mm512_set1_epi64(HASH_K1);
+  const __m512i k2 = _mm512_set1_epi64(HASH_K2);
+  __m512i acc = _mm512_set_epi64(7, 6, 5, 4, 3, 2, 1, 0);
+  for (int i = 0; i < DISPLAY_SIZE; i += 64) {
+    __m512i w = _mm512_loadu_si512(intensity + i);
+    __m512i h = _mm512_xor_si512(acc, _mm512_mullo_epi64(w, k1));
+    acc = _mm512_mullo_epi64(_mm512_rol_epi64(h, 31), k2);
+  }
+  uint64_t lanes[HASH_LANES];
+  _mm512_storeu_si512(lanes, acc);
+  return hashFold(lanes);
+}
+
+AVX512 void avx512Expand(const uint8_t *intensity, void *pixels, int pitch) {
+  const __m512i spread = _mm512_set1_epi32(0x01010100);
+  const __m512i alpha = _mm512_set1_epi32(0xFF);
+  for (int y = 0; y < DISPLAY_HEIGHT; y++) {
+    uint8_t *row = (uint8_t *)pixels + y * pitch;
+    const uint8_t *src = &intensity[y * DISPLAY_WIDTH];
+    for (int x = 0; x < DISPLAY_WIDTH; x += 16) {
+      __m512i v = _mm512_cvtepu8_epi32(
+          _mm_loadu_si128((const __m128i *)(src + x)));
+      v = _mm512_or_si512(_mm512_mullo_epi32(v, spread), alpha);
+      _mm512_storeu_si512(row + 4 * x, v);
+    }
+  }
+}
+
+#pragma GCC diagnostic pop
+
+} // namespace
+
+const displayKernels SSE2_KERNELS = {sse2ComposeOff, sse2ComposeDecay,
+                                     sse2ComposeOr, sse2Hash, sse2Expand};
+const displayKernels AVX2_KERNELS = {avx2ComposeOff, avx2ComposeDecay,
+                                     avx2ComposeOr, avx2Hash, avx2Expand};
+const displayKernels AVX512_KERNELS = {avx512ComposeOff, avx512ComposeDecay,
+                                       avx512ComposeOr, avx512Hash,
+                                       avx512Expand};
+
+#endif
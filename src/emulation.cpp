@@ -0,0 +1,98 @@
+#include "emulation.h"
+
+emulation &emulation::operator=(emulation &&other) noexcept {
+  if (this != &other) {
+    if (handle) {
+      handle.destroy();
+    }
+    handle = other.handle;
+    soundOn = other.soundOn;
+    other.handle = nullptr;
+  }
+  return *this;
+}
+
+emulation::~emulation() {
+  if (handle) {
+    handle.destroy();
+  }
+}
+
+yieldReason emulation::resume() {
+  if (done()) {
+    return YIELD_HALT;
+  }
+  handle.resume();
+  yieldReason reason = handle.promise().reason;
+  if (reason == YIELD_SOUND_ON || reason == YIELD_SOUND_OFF) {
+    soundOn = reason == YIELD_SOUND_ON;
+  }
+  return reason;
+}
+
+yieldReason emulation::runFrame() {
+  yieldReason reason;
+  do {
+    reason = resume();
+  } while (reason == YIELD_SOUND_ON || reason == YIELD_SOUND_OFF);
+  return reason;
+}
+
+namespace {
+
+// The reference interpreter, one instruction per step
+struct plainStepper {
+  int step(cpu &c, int) {
+    c.executeCycle();
+    return 1;
+  }
+};
+
+// stepper::step(c, budget) spends at least one and at most budget units of
+// the frame and returns how many it spent. Units are instructions, except
+// for vipClock's machine cycles.
+template <class stepper> emulation session(cpu &c, int ipf, stepper &s) {
+  bool sound = false;
+  while (c.running) {
+    c.vblank();
+    bool keyWait = false;
+    for (int i = 0; i < ipf;) {
+      i += s.step(c, ipf - i);
+      // the rest of the frame would only re-run the same FX0A, since keys
+      // can't change until the next frame
+      if (c.keyWait) {
+        keyWait = true;
+        break;
+      }
+      if (c.breakIPF || !c.running) {
+        break;
+      }
+    }
+    if (c.timers() != sound) {
+      sound = !sound;
+      co_yield sound ? YIELD_SOUND_ON : YIELD_SOUND_OFF;
+    }
+    if (!c.running) {
+      break;
+    }
+    co_yield keyWait ? YIELD_KEY_WAIT : YIELD_FRAME;
+  }
+}
+
+plainStepper plain;
+
+} // namespace
+
+emulation runSession(cpu &c, int ipf) { return session(c, ipf, plain); }
+
+emulation runSession(cpu &c, int ipf, subroutineMemo &memo) {
+  return session(c, ipf, memo);
+}
+
+emulation runSession(cpu &c, int ipf, irRunner &ir) {
+  return session(c, ipf, ir);
+}
+
+emulation runSession(cpu &c, vipClock &clock) {
+  return session(c, VIP_CHIP8_CYCLES, clock);
+}
@@ -0,0 +1,71 @@
+#pragma once
+#include "cpu.h"
+#include "irrun.h"
+#include "memo.h"
+#include "vipclock.h"
+#include <coroutine>
+#include <exception>
+
+enum yieldReason {
+  YIELD_FRAME,     // a 60Hz frame finished
+  YIELD_KEY_WAIT,  // frame finished early: FX0A is waiting for a key release
+  YIELD_SOUND_ON,  // sound timer became non-zero (frame not finished yet)
+  YIELD_SOUND_OFF, // sound timer reached zero (frame not finished yet)
+  YIELD_HALT       // cpu stopped running
+};
+
+// A cpu run as a coroutine that suspends at frame boundaries, FX0A key
+// waits and sound changes. Frontends resume it instead of driving the
+// instruction loop and polling breakIPF themselves, so many sessions can be
+// interleaved cooperatively on a few threads.
+class emulation {
+public:
+  struct promise_type {
+    yieldReason reason = YIELD_FRAME;
+    emulation get_return_object() {
+      return emulation(
+          std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    std::suspend_always final_suspend() noexcept { return {}; }
+    std::suspend_always yield_value(yieldReason why) noexcept {
+      reason = why;
+      return {};
+    }
+    void return_void() noexcept { reason = YIELD_HALT; }
+    // nothing in the frame loop can recover from one mid-frame
+    void unhandled_exception() noexcept { std::terminate(); }
+  };
+
+  emulation() : handle(nullptr) {}
+  emulation(emulation &&other) noexcept : handle(other.handle) {
+    other.handle = nullptr;
+  }
+  emulation &operator=(emulation &&other) noexcept;
+  emulation(const emulation &) = delete;
+  emulation &operator=(const emulation &) = delete;
+  ~emulation();
+
+  // Runs until the next suspension point and returns why it stopped
+  yieldReason resume();
+  // Resumes past sound events until the frame ends; returns the frame's
+  // ending reason (FRAME, KEY_WAIT or HALT)
+  yieldReason runFrame();
+  bool done() const { return !handle || handle.done(); }
+  bool sounding() const { return soundOn; }
+
+private:
+  explicit emulation(std::coroutine_handle<promise_type> h)
+      : handle(h), soundOn(false) {}
+  std::coroutine_handle<promise_type> handle;
+  bool soundOn;
+};
+
+// Starts a suspended session; nothing runs until the first resume. With a
+// memo, pure subroutine calls are replayed from it instead of executed;
+// with an irRunner, code runs as compiled IR blocks. With a vipClock, a
+// frame is VIP_CHIP8_CYCLES machine cycles rather than ipf instructions.
+emulation runSession(cpu &c, int ipf);
+emulation runSession(cpu &c, int ipf, subroutineMemo &memo);
+emulation runSession(cpu &c, int ipf, irRunner &ir);
+emulation runSession(cpu &c, vipClock &clock);
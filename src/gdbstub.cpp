@@ -0,0 +1,445 @@
+#include "gdbstub.h"
+#include "log.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static const char *TARGET_XML =
+    "<?xml version=\"1.0\"?>"
+    "<!DOCTYPE target SYSTEM \"gdb-target.dtd\">"
+    "<target version=\"1.0\"><feature name=\"org.chip8.core\">"
+    "<reg name=\"v0\" bitsize=\"8\" regnum=\"0\"/>"
+    "<reg name=\"v1\" bitsize=\"8\"/><reg name=\"v2\" bitsize=\"8\"/>"
+    "<reg name=\"v3\" bitsize=\"8\"/><reg name=\"v4\" bitsize=\"8\"/>"
+    "<reg name=\"v5\" bitsize=\"8\"/><reg name=\"v6\" bitsize=\"8\"/>"
+    "<reg name=\"v7\" bitsize=\"8\"/><reg name=\"v8\" bitsize=\"8\"/>"
+    "<reg name=\"v9\" bitsize=\"8\"/><reg name=\"va\" bitsize=\"8\"/>"
+    "<reg name=\"vb\" bitsize=\"8\"/><reg name=\"vc\" bitsize=\"8\"/>"
+    "<reg name=\"vd\" bitsize=\"8\"/><reg name=\"ve\" bitsize=\"8\"/>"
+    "<reg name=\"vf\" bitsize=\"8\"/>"
+    "<reg name=\"i\" bitsize=\"16\" type=\"data_ptr\"/>"
+    "<reg name=\"pc\" bitsize=\"16\" type=\"code_ptr\"/>"
+    "<reg name=\"sp\" bitsize=\"16\"/>"
+    "</feature></target>";
+
+const int REG_I = 16;
+const int REG_PC = 17;
+const int REG_SP = 18;
+
+static int hexDigit(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+static void appendHex8(std::string &out, uint8_t value) {
+  static const char digits[] = "0123456789abcdef";
+  out += digits[value >> 4];
+  out += digits[value & 0xF];
+}
+
+// Parses hex starting at pos, stopping at the first non-hex character
+static unsigned long parseHex(const std::string &s, size_t &pos) {
+  unsigned long value = 0;
+  while (pos < s.size() && hexDigit(s[pos]) >= 0) {
+    value = (value << 4) | hexDigit(s[pos]);
+    pos++;
+  }
+  return value;
+}
+
+gdbStub::gdbStub()
+    : target(NULL), dbg(NULL), listenFd(-1), clientFd(-1), connected(false),
+      haltRequested(false), killRequested(false), quit(false), halted(false),
+      stopPending(false), clientWaiting(false), stopSignal(5), noAck(false) {}
+
+gdbStub::~gdbStub() { shutdown(); }
+
+bool gdbStub::start(int port, cpu &c, debugger &d) {
+  target = &c;
+  dbg = &d;
+  listenFd = socket(AF_INET, SOCK_STREAM, 0);
+  if (listenFd < 0) {
+    LOG_ERROR("gdb_socket_failed");
+    return false;
+  }
+  int yes = 1;
+  setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK); // local debugging only
+  if (bind(listenFd, (sockaddr *)&addr, sizeof(addr)) != 0 ||
+      listen(listenFd, 1) != 0) {
+    LOG_ERROR("gdb_listen_failed", "port", port);
+    close(listenFd);
+    listenFd = -1;
+    return false;
+  }
+  LOG_INFO("gdb_listening", "address", "127.0.0.1", "port", port);
+  thread = std::thread(&gdbStub::run, this);
+  return true;
+}
+
+void gdbStub::shutdown() {
+  if (!thread.joinable()) {
+    return;
+  }
+  quit = true;
+  release();
+  thread.join();
+  if (clientFd >= 0) {
+    close(clientFd);
+    clientFd = -1;
+  }
+  close(listenFd);
+  listenFd = -1;
+}
+
+bool gdbStub::holding() {
+  if (killRequested.load(std::memory_order_relaxed)) {
+    killRequested = false;
+    target->running = false; // the client sent k
+    return true;
+  }
+  if (!connected.load(std::memory_order_relaxed)) {
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(mutex);
+  if (!halted) {
+    bool trapped = dbg->isStopped();
+    if (!haltRequested && !trapped) {
+      return false;
+    }
+    halted = true;
+    stopPending = true;
+    stopSignal = trapped ? 5 : 2; // SIGTRAP for breakpoints, SIGINT for ^C
+    haltRequested = false;
+    cond.notify_all();
+  }
+  return true;
+}
+
+// Waits for the emulation loop to reach the next frame boundary and stop
+bool gdbStub::waitHalted() {
+  std::unique_lock<std::mutex> lock(mutex);
+  if (!halted) {
+    haltRequested = true;
+    cond.wait_for(lock, std::chrono::seconds(1),
+                  [this] { return halted || quit.load(); });
+  }
+  return halted;
+}
+
+void gdbStub::release() {
+  std::lock_guard<std::mutex> lock(mutex);
+  halted = false;
+  stopPending = false;
+  haltRequested = false;
+  cond.notify_all();
+}
+
+void gdbStub::run() {
+  while (!quit) {
+    if (clientFd < 0) {
+      acceptClient();
+      continue;
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (halted && stopPending && clientWaiting) {
+        stopPending = false;
+        clientWaiting = false;
+        sendPacket(stopReply());
+      }
+    }
+    pollfd pfd = {clientFd, POLLIN, 0};
+    if (::poll(&pfd, 1, 10) > 0) {
+      readClient();
+    }
+  }
+}
+
+void gdbStub::acceptClient() {
+  pollfd pfd = {listenFd, POLLIN, 0};
+  if (::poll(&pfd, 1, 100) <= 0) {
+    return;
+  }
+  clientFd = accept(listenFd, NULL, NULL);
+  if (clientFd < 0) {
+    return;
+  }
+  noAck = false;
+  clientWaiting = false;
+  inbox.clear();
+  haltRequested = true; // gdb expects a stopped target on attach
+  connected = true;
+  LOG_INFO("gdb_attached");
+}
+
+void gdbStub::disconnect() {
+  close(clientFd);
+  clientFd = -1;
+  // the debugger is only ours while the loop is parked; holding() keeps it
+  // parked until connected is cleared below
+  bool parked = waitHalted();
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (parked && dbg->isStopped()) {
+      dbg->resume();
+    }
+    halted = false;
+    stopPending = false;
+    haltRequested = false;
+    connected = false;
+    cond.notify_all();
+  }
+  LOG_INFO("gdb_detached");
+}
+
+void gdbStub::readClient() {
+  char buf[1024];
+  ssize_t n = read(clientFd, buf, sizeof(buf));
+  if (n <= 0) {
+    disconnect();
+    return;
+  }
+  inbox.append(buf, n);
+  while (!inbox.empty() && clientFd >= 0) {
+    char c = inbox[0];
+    if (c == 0x03) { // ^C: interrupt
+      inbox.erase(0, 1);
+      haltRequested = true;
+      clientWaiting = true;
+      continue;
+    }
+    if (c != '$') { // acks and line noise
+      inbox.erase(0, 1);
+      continue;
+    }
+    size_t hash = inbox.find('#');
+    if (hash == std::string::npos || hash + 2 >= inbox.size()) {
+      return; // incomplete packet
+    }
+    std::string packet = inbox.substr(1, hash - 1);
+    inbox.erase(0, hash + 3);
+    if (!noAck) {
+      write(clientFd, "+", 1);
+    }
+    handlePacket(packet);
+  }
+}
+
+void gdbStub::sendPacket(const std::string &data) {
+  uint8_t sum = 0;
+  for (size_t i = 0; i < data.size(); i++) {
+    sum += (uint8_t)data[i];
+  }
+  std::string out = "$" + data + "#";
+  appendHex8(out, sum);
+  write(clientFd, out.data(), out.size());
+}
+
+std::string gdbStub::stopReply() const {
+  std::string reply = "S";
+  appendHex8(reply, stopSignal);
+  return reply;
+}
+
+std::string gdbStub::readRegisters() const {
+  std::string out;
+  for (int i = 0; i < 16; i++) {
+    appendHex8(out, target->V[i]);
+  }
+  uint16_t wide[3] = {dbg->getI(*target), dbg->getPC(*target),
+                      dbg->getSP(*target)};
+  for (int i = 0; i < 3; i++) {
+    appendHex8(out, wide[i] & 0xFF);
+    appendHex8(out, wide[i] >> 8);
+  }
+  return out;
+}
+
+void gdbStub::writeRegister(int reg, uint16_t value) {
+  if (reg < 16) {
+    target->V[reg] = value & 0xFF;
+  } else if (reg == REG_I) {
+    dbg->setI(*target, value);
+  } else if (reg == REG_PC) {
+    dbg->setPC(*target, value);
+  } else if (reg == REG_SP) {
+    dbg->setSP(*target, value);
+  }
+}
+
+// Reads a little endian register value of the given byte width
+static uint16_t parseRegister(const std::string &s, size_t pos, int bytes) {
+  uint16_t value = 0;
+  for (int b = 0; b < bytes && pos + 1 < s.size(); b++, pos += 2) {
+    int byte = hexDigit(s[pos]) << 4 | hexDigit(s[pos + 1]);
+    value |= byte << (8 * b);
+  }
+  return value;
+}
+
+void gdbStub::handlePacket(const std::string &packet) {
+  char cmd = packet.empty() ? 0 : packet[0];
+  size_t pos = 1;
+
+  // commands that need no access to the cpu
+  if (packet.compare(0, 10, "qSupported") == 0) {
+    sendPacket("PacketSize=1000;qXfer:features:read+;QStartNoAckMode+");
+    return;
+  }
+  if (packet == "QStartNoAckMode") {
+    sendPacket("OK");
+    noAck = true;
+    return;
+  }
+  if (packet.compare(0, 31, "qXfer:features:read:target.xml:") == 0) {
+    pos = 31;
+    unsigned long offset = parseHex(packet, pos);
+    pos++;
+    unsigned long length = parseHex(packet, pos);
+    size_t total = strlen(TARGET_XML);
+    if (offset >= total) {
+      sendPacket("l");
+    } else {
+      std::string chunk(TARGET_XML + offset,
+                        std::min((size_t)length, total - offset));
+      sendPacket((offset + chunk.size() < total ? "m" : "l") + chunk);
+    }
+    return;
+  }
+  if (packet == "qAttached") {
+    sendPacket("1");
+    return;
+  }
+  if (cmd == 'H' || packet == "qC") {
+    sendPacket(cmd == 'H' ? "OK" : "");
+    return;
+  }
+
+  if (!waitHalted()) {
+    sendPacket("E01");
+    return;
+  }
+  // the emulation loop is holding the cpu; it is safe to access from here
+  switch (cmd) {
+  case ('?'): {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopPending = false;
+    sendPacket(stopReply());
+    break;
+  }
+  case ('g'):
+    sendPacket(readRegisters());
+    break;
+  case ('G'): {
+    for (int i = 0; i < 16; i++) {
+      writeRegister(i, parseRegister(packet, 1 + i * 2, 1));
+    }
+    for (int i = 0; i < 3; i++) {
+      writeRegister(REG_I + i, parseRegister(packet, 33 + i * 4, 2));
+    }
+    sendPacket("OK");
+    break;
+  }
+  case ('p'): {
+    int reg = parseHex(packet, pos);
+    std::string regs = readRegisters();
+    if (reg < 16) {
+      sendPacket(regs.substr(reg * 2, 2));
+    } else if (reg <= REG_SP) {
+      sendPacket(regs.substr(32 + (reg - REG_I) * 4, 4));
+    } else {
+      sendPacket("E02");
+    }
+    break;
+  }
+  case ('P'): {
+    int reg = parseHex(packet, pos);
+    pos++; // '='
+    writeRegister(reg, parseRegister(packet, pos, reg < 16 ? 1 : 2));
+    sendPacket("OK");
+    break;
+  }
+  case ('m'): {
+    uint16_t addr = parseHex(packet, pos);
+    pos++; // ','
+    unsigned long length = parseHex(packet, pos);
+    std::string out;
+    for (unsigned long i = 0; i < length && i < 4096; i++) {
+      appendHex8(out, dbg->peek(*target, addr + i));
+    }
+    sendPacket(out);
+    break;
+  }
+  case ('M'): {
+    uint16_t addr = parseHex(packet, pos);
+    pos++; // ','
+    unsigned long length = parseHex(packet, pos);
+    pos++; // ':'
+    for (unsigned long i = 0; i < length && pos + 1 < packet.size();
+         i++, pos += 2) {
+      uint8_t byte = hexDigit(packet[pos]) << 4 | hexDigit(packet[pos + 1]);
+      dbg->poke(*target, addr + i, byte);
+    }
+    sendPacket("OK");
+    break;
+  }
+  case ('Z'):
+  case ('z'): {
+    if (packet.size() < 2 || packet[1] != '0') {
+      sendPacket(""); // only software breakpoints
+      break;
+    }
+    pos = 3;
+    uint16_t addr = parseHex(packet, pos);
+    if (cmd == 'Z') {
+      dbg->addBreakpoint(addr);
+    } else {
+      dbg->removeBreakpoint(addr);
+    }
+    sendPacket("OK");
+    break;
+  }
+  case ('c'):
+  case ('s'): {
+    if (cmd == 's') {
+      dbg->stepInstruction();
+    } else if (dbg->isStopped()) {
+      dbg->resume();
+    }
+    clientWaiting = true;
+    release();
+    break;
+  }
+  case ('k'):
+    killRequested = true; // applied by the emulation loop in holding()
+    disconnect();
+    break;
+  case ('D'):
+    sendPacket("OK");
+    disconnect();
+    break;
+  default:
+    sendPacket(""); // unsupported
+    break;
+  }
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include "cpu.h"
+#include "debugger.h"
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// GDB remote serial protocol server for a running cpu. Sockets are handled
+// on a separate thread; the emulation loop only checks an atomic flag per
+// frame and pauses once a client has asked the target to stop.
+//
+// Registers are exposed as v0-vf (8 bit), i, pc and sp (16 bit little
+// endian) and memory as the 4KB address space.
+class gdbStub {
+private:
+  cpu *target;
+  debugger *dbg;
+  int listenFd;
+  int clientFd;
+  std::thread thread;
+  std::mutex mutex;
+  std::condition_variable cond;
+  std::atomic<bool> connected;
+  std::atomic<bool> haltRequested;
+  std::atomic<bool> killRequested; // k: the loop stops the cpu
+  std::atomic<bool> quit;
+  bool halted;        // emulation loop is holding the cpu for the client
+  bool stopPending;   // halted since the client last heard a stop reply
+  bool clientWaiting; // client sent c/s and is waiting for a stop reply
+  int stopSignal;
+  bool noAck;
+  std::string inbox;
+
+  void run();
+  void acceptClient();
+  void disconnect();
+  void readClient();
+  void handlePacket(const std::string &packet);
+  void sendPacket(const std::string &data);
+  bool waitHalted();
+  void release();
+  std::string stopReply() const;
+  std::string readRegisters() const;
+  void writeRegister(int reg, uint16_t value);
+
+public:
+  gdbStub();
+  ~gdbStub();
+  bool start(int port, cpu &c, debugger &d);
+  void shutdown();
+  bool attached() const { return connected.load(std::memory_order_relaxed); }
+  // Called by the emulation loop once per frame. Returns true while the
+  // client holds the cpu stopped; the cpu must not be run until it's false.
+  // A kill from the client is applied here, clearing cpu.running.
+  bool holding();
+};
@@ -0,0 +1,77 @@
+#include "heatmap.h"
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+void heatmap::init() {
+  memset(reads, 0, sizeof(reads));
+  memset(writes, 0, sizeof(writes));
+  memset(executes, 0, sizeof(executes));
+}
+
+int heatmap::classify(uint16_t addr) const {
+  addr &= 0xFFF;
+  int use = 0;
+  if (executes[addr]) {
+    use |= USE_CODE;
+  }
+  if (reads[addr] || writes[addr]) {
+    use |= USE_DATA;
+  }
+  return use;
+}
+
+// Scales a count to 0-255 relative to the busiest byte
+static uint8_t heat(uint32_t count, double logMax) {
+  if (count == 0 || logMax <= 0) {
+    return 0;
+  }
+  return (uint8_t)(64 + 191 * (log((double)count + 1) / logMax));
+}
+
+bool heatmap::writeImage(const char *path) const {
+  FILE *out = fopen(path, "wb");
+  if (!out) {
+    return false;
+  }
+  uint32_t maxCount = 1;
+  for (int i = 0; i < 4096; i++) {
+    uint32_t counts[3] = {reads[i], writes[i], executes[i]};
+    for (int c = 0; c < 3; c++) {
+      if (counts[c] > maxCount) {
+        maxCount = counts[c];
+      }
+    }
+  }
+  double logMax = log((double)maxCount + 1);
+  fprintf(out, "P6\n64 64\n255\n");
+  for (int i = 0; i < 4096; i++) {
+    uint8_t pixel[3] = {heat(writes[i], logMax), heat(executes[i], logMax),
+                        heat(reads[i], logMax)};
+    fwrite(pixel, 1, 3, out);
+  }
+  fclose(out);
+  return true;
+}
+
+bool heatmap::writeMap(const char *path) const {
+  static const char *names[] = {"unused", "code", "data", "code+data"};
+  FILE *out = fopen(path, "w");
+  if (!out) {
+    return false;
+  }
+  int start = 0;
+  int use = classify(0);
+  for (int addr = 1; addr <= 4096; addr++) {
+    int next = addr < 4096 ? classify(addr) : -1;
+    if (next != use) {
+      if (use != 0) {
+        fprintf(out, "0x%03X-0x%03X %s\n", start, addr - 1, names[use]);
+      }
+      start = addr;
+      use = next;
+    }
+  }
+  fclose(out);
+  return true;
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include <cstdint>
+
+enum memoryUse { USE_CODE = 1, USE_DATA = 2 };
+
+// Hook policy for cpu::step that counts reads, writes and instruction
+// fetches for every byte of the 4KB address space
+class heatmap {
+private:
+  uint32_t reads[4096];
+  uint32_t writes[4096];
+  uint32_t executes[4096];
+
+public:
+  void init();
+  void onExecute(uint16_t addr) {
+    executes[addr & 0xFFF]++;
+    executes[(addr + 1) & 0xFFF]++;
+  }
+  void onRead(uint16_t addr) { reads[addr & 0xFFF]++; }
+  void onWrite(uint16_t addr) { writes[addr & 0xFFF]++; }
+
+  // USE_CODE and/or USE_DATA bits for an address, 0 if never touched.
+  // Lets a disassembler or recompiler tell instructions from sprite data.
+  int classify(uint16_t addr) const;
+  // 64x64 PPM, one pixel per byte: red = writes, green = executes,
+  // blue = reads, each on a log scale
+  bool writeImage(const char *path) const;
+  // Text map of address ranges: "0x200-0x2A3 code", "0x2A4-0x2B3 data"
+  bool writeMap(const char *path) const;
+};
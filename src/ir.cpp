@@ -0,0 +1,458 @@
+#include "ir.h"
+
+namespace {
+
+enum liftResult {
+  LIFT_NEXT,  // lifted, carry on with the next instruction
+  LIFT_END,   // lifted, and it set the block's exit
+  LIFT_INTERP // left to the interpreter; not lifted
+};
+
+void emit(irBlock &b, irOpcode code, int dst, int a = 0, int r = 0,
+          uint16_t imm = 0) {
+  b.ops.push_back({code, (uint8_t)dst, (uint8_t)a, (uint8_t)r, imm});
+}
+
+void branch(irBlock &b, irCond cond, int a, int r, uint8_t imm,
+            uint16_t pc) {
+  b.exit = {EXIT_BRANCH, cond, (uint8_t)a, (uint8_t)r, imm,
+            (uint16_t)(pc + 4), (uint16_t)(pc + 2)};
+}
+
+void jump(irBlock &b, irExitKind kind, uint16_t target, uint16_t fall = 0) {
+  b.exit = {kind, COND_EQ, 0, 0, 0, target, fall};
+}
+
+// Flag-setting ALU ops: the flag goes to IR_TEMP first, since VX may be VF
+void withFlag(irBlock &b, irOpcode flag, int fa, int fb, irOpcode op, int x,
+              int a, int r) {
+  emit(b, flag, IR_TEMP, fa, fb);
+  emit(b, op, x, a, r);
+  emit(b, IR_MOV, 0xF, IR_TEMP);
+}
+
+// Appends the ops for the instruction at pc, following cpu::step
+liftResult liftOne(uint16_t op, uint16_t pc, irBlock &b) {
+  int x = (op >> 8) & 0xF;
+  int y = (op >> 4) & 0xF;
+  uint8_t nn = op & 0xFF;
+  uint16_t nnn = op & 0xFFF;
+  switch (op & 0xF000) {
+  case (0x0000):
+    if ((op & 0xF) == 0x0) {
+      emit(b, IR_CLS, 0);
+    } else if ((op & 0xF) == 0xE) {
+      jump(b, EXIT_RET, 0);
+      return LIFT_END;
+    }
+    return LIFT_NEXT;
+  case (0x1000):
+    jump(b, EXIT_GOTO, nnn);
+    return LIFT_END;
+  case (0x2000):
+    jump(b, EXIT_CALL, nnn, pc + 2);
+    return LIFT_END;
+  case (0x3000):
+    branch(b, COND_EQ_IMM, x, 0, nn, pc);
+    return LIFT_END;
+  case (0x4000):
+    branch(b, COND_NE_IMM, x, 0, nn, pc);
+    return LIFT_END;
+  case (0x5000):
+    branch(b, COND_EQ, x, y, 0, pc);
+    return LIFT_END;
+  case (0x6000):
+    emit(b, IR_SET, x, 0, 0, nn);
+    return LIFT_NEXT;
+  case (0x7000):
+    emit(b, IR_ADDK, x, x, 0, nn);
+    return LIFT_NEXT;
+  case (0x8000):
+    switch (op & 0xF) {
+    case (0x0):
+      emit(b, IR_MOV, x, y);
+      break;
+    case (0x1):
+      emit(b, IR_OR, x, x, y);
+      emit(b, IR_SET, 0xF);
+      break;
+    case (0x2):
+      emit(b, IR_AND, x, x, y);
+      emit(b, IR_SET, 0xF);
+      break;
+    case (0x3):
+      emit(b, IR_XOR, x, x, y);
+      emit(b, IR_SET, 0xF);
+      break;
+    case (0x4):
+      withFlag(b, IR_CARRY, x, y, IR_ADD, x, x, y);
+      break;
+    case (0x5):
+      withFlag(b, IR_GE, x, y, IR_SUB, x, x, y);
+      break;
+    case (0x6): // VIP quirk: flag from VX, result from VY
+      withFlag(b, IR_BIT0, x, 0, IR_SHR, x, y, 0);
+      break;
+    case (0x7):
+      withFlag(b, IR_GE, y, x, IR_SUB, x, y, x);
+      break;
+    case (0xE): // VIP quirk: flag and result both from VY
+      withFlag(b, IR_BIT7, y, 0, IR_SHL, x, y, 0);
+      break;
+    }
+    return LIFT_NEXT;
+  case (0x9000):
+    branch(b, COND_NE, x, y, 0, pc);
+    return LIFT_END;
+  case (0xA000):
+    emit(b, IR_SETI, 0, 0, 0, nnn);
+    return LIFT_NEXT;
+  case (0xB000):
+    jump(b, EXIT_JUMP_V0, nnn);
+    return LIFT_END;
+  case (0xC000):
+    emit(b, IR_RAND, x, 0, 0, nn);
+    return LIFT_NEXT;
+  case (0xD000):
+    return LIFT_INTERP; // vblank wait and collision
+  case (0xE000):
+    if (nn == 0x9E) {
+      branch(b, COND_KEY, x, 0, 0, pc);
+      return LIFT_END;
+    }
+    if (nn == 0xA1) {
+      branch(b, COND_NO_KEY, x, 0, 0, pc);
+      return LIFT_END;
+    }
+    return LIFT_NEXT;
+  default: // 0xF000
+    switch (nn) {
+    case (0x0A):
+      return LIFT_INTERP; // key wait
+    case (0x07):
+      emit(b, IR_GETDELAY, x);
+      break;
+    case (0x15):
+      emit(b, IR_SETDELAY, 0, x);
+      break;
+    case (0x18):
+      emit(b, IR_SETSOUND, 0, x);
+      break;
+    case (0x1E):
+      emit(b, IR_ADDI, 0, x);
+      break;
+    case (0x29):
+      emit(b, IR_FONT, 0, x);
+      break;
+    // Memory writes end the block, so one that rewrites code later in the
+    // block is noticed before that code runs
+    case (0x33):
+      emit(b, IR_BCD, 0, x);
+      jump(b, EXIT_STOP, pc + 2);
+      return LIFT_END;
+    case (0x55):
+      emit(b, IR_STORE, 0, 0, 0, x);
+      jump(b, EXIT_STOP, pc + 2);
+      return LIFT_END;
+    case (0x65):
+      emit(b, IR_LOAD, 0, 0, 0, x);
+      break;
+    }
+    return LIFT_NEXT;
+  }
+}
+
+// Lifts instructions from pc onto the end of the block until one sets the
+// exit
+void liftInto(const irSource &src, uint16_t pc, int maxInstructions,
+              irBlock &b) {
+  for (;;) {
+    // stop short of wrapping past the end of memory
+    if (pc > 0xFFE || b.instructions >= maxInstructions) {
+      jump(b, EXIT_STOP, pc);
+      return;
+    }
+    uint16_t op = src.fetch(pc);
+    liftResult r = liftOne(op, pc, b);
+    if (r == LIFT_INTERP) {
+      jump(b, EXIT_STOP, pc);
+      return;
+    }
+    b.code.push_back(pc);
+    b.instructions++;
+    b.lastOpcode = op;
+    if (r == LIFT_END) {
+      return;
+    }
+    pc += 2;
+  }
+}
+
+bool lifted(const irBlock &b, uint16_t pc) {
+  for (uint16_t addr : b.code) {
+    if (addr == pc) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool usesA(irOpcode code) {
+  return code >= IR_MOV && code <= IR_BIT7;
+}
+
+bool usesB(irOpcode code) {
+  switch (code) {
+  case (IR_ADD):
+  case (IR_SUB):
+  case (IR_OR):
+  case (IR_AND):
+  case (IR_XOR):
+  case (IR_CARRY):
+  case (IR_GE):
+    return true;
+  default:
+    return false;
+  }
+}
+
+} // namespace
+
+bool liftBlock(const irSource &src, uint16_t pc, int maxInstructions,
+               irBlock &block) {
+  block.start = pc;
+  block.instructions = 0;
+  block.lastOpcode = 0;
+  block.ops.clear();
+  block.code.clear();
+  liftInto(src, pc, maxInstructions, block);
+  return block.instructions > 0;
+}
+
+// A static jump or call continues lifting at its target, unless that would
+// loop back into code already in the block
+void mergeBlocks(const irSource &src, irBlock &block, int maxInstructions) {
+  while (block.instructions < maxInstructions) {
+    const irExit exit = block.exit;
+    if (exit.kind != EXIT_GOTO && exit.kind != EXIT_CALL) {
+      return;
+    }
+    if (lifted(block, exit.target)) {
+      return;
+    }
+    if (exit.kind == EXIT_CALL) {
+      emit(block, IR_PUSH, 0, 0, 0, exit.fall);
+    }
+    liftInto(src, exit.target, maxInstructions, block);
+  }
+}
+
+void foldConstants(irBlock &block) {
+  bool known[IR_REGS] = {};
+  uint8_t value[IR_REGS] = {};
+  bool knownI = false;
+  uint16_t valueI = 0;
+  uint16_t pushed[16]; // return addresses pushed by merged calls
+  int depth = 0;
+
+  for (irOp &op : block.ops) {
+    switch (op.code) {
+    case (IR_SET):
+      known[op.dst] = true;
+      value[op.dst] = op.imm;
+      break;
+    case (IR_MOV):
+    case (IR_ADD):
+    case (IR_ADDK):
+    case (IR_SUB):
+    case (IR_OR):
+    case (IR_AND):
+    case (IR_XOR):
+    case (IR_SHR):
+    case (IR_SHL):
+    case (IR_CARRY):
+    case (IR_GE):
+    case (IR_BIT0):
+    case (IR_BIT7):
+      if (known[op.a] && (!usesB(op.code) || known[op.b])) {
+        uint8_t v = irEvaluate(op, value[op.a], value[op.b]);
+        op = {IR_SET, op.dst, 0, 0, v};
+        known[op.dst] = true;
+        value[op.dst] = v;
+      } else {
+        known[op.dst] = false;
+      }
+      break;
+    case (IR_GETDELAY):
+    case (IR_RAND):
+      known[op.dst] = false;
+      break;
+    case (IR_SETI):
+      knownI = true;
+      valueI = op.imm;
+      break;
+    case (IR_ADDI):
+      if (knownI && known[op.a]) {
+        valueI += value[op.a];
+        op = {IR_SETI, 0, 0, 0, valueI};
+      } else {
+        knownI = false;
+      }
+      break;
+    case (IR_FONT):
+      if (known[op.a]) {
+        valueI = value[op.a] * 5;
+        knownI = true;
+        op = {IR_SETI, 0, 0, 0, valueI};
+      } else {
+        knownI = false;
+      }
+      break;
+    case (IR_LOAD):
+      for (int i = 0; i <= op.imm; i++) {
+        known[i] = false;
+      }
+      valueI += op.imm + 1;
+      break;
+    case (IR_STORE):
+      valueI += op.imm + 1;
+      break;
+    case (IR_PUSH):
+      if (depth < 16) {
+        pushed[depth++] = op.imm;
+      } else {
+        depth = 0; // the stack wrapped; forget what's on it
+      }
+      break;
+    case (IR_POP):
+      if (depth > 0) {
+        depth--;
+      }
+      break;
+    default:
+      break;
+    }
+  }
+
+  irExit &exit = block.exit;
+  switch (exit.kind) {
+  case (EXIT_BRANCH): {
+    bool decided = false, taken = false;
+    switch (exit.cond) {
+    case (COND_EQ_IMM):
+    case (COND_NE_IMM):
+      decided = known[exit.a];
+      taken = (value[exit.a] == exit.imm) == (exit.cond == COND_EQ_IMM);
+      break;
+    case (COND_EQ):
+    case (COND_NE):
+      decided = known[exit.a] && known[exit.b];
+      taken = (value[exit.a] == value[exit.b]) == (exit.cond == COND_EQ);
+      break;
+    default: // keys are only known at run time
+      break;
+    }
+    if (decided) {
+      jump(block, EXIT_GOTO, taken ? exit.target : exit.fall);
+    }
+    break;
+  }
+  case (EXIT_JUMP_V0):
+    if (known[0]) {
+      jump(block, EXIT_GOTO, exit.target + value[0]);
+    }
+    break;
+  case (EXIT_RET):
+    if (depth > 0) {
+      // returning from a call merged into this block
+      emit(block, IR_POP, 0);
+      jump(block, EXIT_GOTO, pushed[depth - 1]);
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+// Backwards liveness: every V register is live when the block exits,
+// IR_TEMP is not. Ops with effects beyond their destination always stay.
+void removeDeadFlags(irBlock &block) {
+  bool live[IR_REGS];
+  for (int i = 0; i < IR_REGS; i++) {
+    live[i] = i < 16;
+  }
+  size_t kept = block.ops.size();
+  for (size_t n = block.ops.size(); n-- > 0;) {
+    const irOp op = block.ops[n];
+    switch (op.code) {
+    case (IR_SET):
+    case (IR_GETDELAY):
+    case (IR_MOV):
+    case (IR_ADD):
+    case (IR_ADDK):
+    case (IR_SUB):
+    case (IR_OR):
+    case (IR_AND):
+    case (IR_XOR):
+    case (IR_SHR):
+    case (IR_SHL):
+    case (IR_CARRY):
+    case (IR_GE):
+    case (IR_BIT0):
+    case (IR_BIT7):
+      if (!live[op.dst]) {
+        continue; // dropped
+      }
+      live[op.dst] = false;
+      if (usesA(op.code)) {
+        live[op.a] = true;
+      }
+      if (usesB(op.code)) {
+        live[op.b] = true;
+      }
+      break;
+    case (IR_RAND):
+      live[op.dst] = false; // still advances the generator
+      break;
+    case (IR_ADDI):
+    case (IR_FONT):
+    case (IR_BCD):
+    case (IR_SETDELAY):
+    case (IR_SETSOUND):
+      live[op.a] = true;
+      break;
+    case (IR_STORE):
+      for (int i = 0; i <= op.imm; i++) {
+        live[i] = true;
+      }
+      break;
+    case (IR_LOAD):
+      for (int i = 0; i <= op.imm; i++) {
+        live[i] = false;
+      }
+      break;
+    default:
+      break;
+    }
+    block.ops[--kept] = op;
+  }
+  block.ops.erase(block.ops.begin(), block.ops.begin() + kept);
+}
+
+bool compileBlock(const irSource &src, uint16_t pc, int maxInstructions,
+                  irBlock &block) {
+  if (!liftBlock(src, pc, maxInstructions, block)) {
+    return false;
+  }
+  // folding can turn a branch or return into a jump worth merging through
+  for (int round = 0; round < 4; round++) {
+    mergeBlocks(src, block, maxInstructions);
+    irExitKind before = block.exit.kind;
+    foldConstants(block);
+    if (before == block.exit.kind) {
+      break;
+    }
+  }
+  removeDeadFlags(block);
+  return true;
+}
@@ -0,0 +1,147 @@
+#pragma once
+#include "cpu.h"
+#include <cstdint>
+#include <vector>
+
+// Register-based intermediate form for CHIP-8 code. A block is lifted from
+// a start address into straight-line ops followed by one exit. The lifter
+// spells out what the interpreter does implicitly: every VF effect is its
+// own op (8XY4 becomes carry into a temporary, add, copy to VF), skips
+// become conditional exits, and the VIP 8XY6/8XYE quirks (flag from VX,
+// result from VY) are written out. Passes then work on that form, so an
+// optimisation is written once for whatever executes it.
+//
+// Registers 0-15 are V0-VF; IR_TEMP holds a flag between its computation
+// and the copy into VF. I is implicit in the ops that use it.
+
+const int IR_TEMP = 16;
+const int IR_REGS = 17;
+
+enum irOpcode : uint8_t {
+  IR_SET,      // dst = imm
+  IR_MOV,      // dst = a
+  IR_ADD,      // dst = a + b
+  IR_ADDK,     // dst = a + imm
+  IR_SUB,      // dst = a - b
+  IR_OR,       // dst = a | b
+  IR_AND,      // dst = a & b
+  IR_XOR,      // dst = a ^ b
+  IR_SHR,      // dst = a >> 1
+  IR_SHL,      // dst = a << 1
+  IR_CARRY,    // dst = a + b > 255
+  IR_GE,       // dst = a >= b
+  IR_BIT0,     // dst = a & 1
+  IR_BIT7,     // dst = a >> 7
+  IR_SETI,     // I = imm
+  IR_ADDI,     // I += a
+  IR_FONT,     // I = a * 5
+  IR_BCD,      // memory[I..I+2] = digits of a
+  IR_STORE,    // memory[I..] = V0..Vimm, I += imm + 1
+  IR_LOAD,     // V0..Vimm = memory[I..], I += imm + 1
+  IR_GETDELAY, // dst = delay timer
+  IR_SETDELAY, // delay timer = a
+  IR_SETSOUND, // sound timer = a
+  IR_RAND,     // dst = next random byte & imm
+  IR_CLS,      // clear the display
+  IR_PUSH,     // stack[sp++] = imm (a call merged into the block)
+  IR_POP       // sp-- (its return, once the address is known)
+};
+
+struct irOp {
+  irOpcode code;
+  uint8_t dst, a, b;
+  uint16_t imm;
+};
+
+// Result of the pure ALU ops (IR_MOV to IR_BIT7), as cpu::step computes it
+constexpr uint8_t irEvaluate(const irOp &op, uint8_t a, uint8_t b) {
+  switch (op.code) {
+  case (IR_ADD):
+    return a + b;
+  case (IR_ADDK):
+    return a + op.imm;
+  case (IR_SUB):
+    return a - b;
+  case (IR_OR):
+    return a | b;
+  case (IR_AND):
+    return a & b;
+  case (IR_XOR):
+    return a ^ b;
+  case (IR_SHR):
+    return a >> 1;
+  case (IR_SHL):
+    return a << 1;
+  case (IR_CARRY):
+    return a + b > 255;
+  case (IR_GE):
+    return a >= b;
+  case (IR_BIT0):
+    return a & 1;
+  case (IR_BIT7):
+    return a >> 7;
+  default: // IR_MOV
+    return a;
+  }
+}
+
+enum irExitKind : uint8_t {
+  EXIT_STOP,    // pc = target; the block can't be extended past here
+  EXIT_GOTO,    // pc = target
+  EXIT_CALL,    // push ret, pc = target
+  EXIT_RET,     // pc = popped address
+  EXIT_JUMP_V0, // pc = target + V0
+  EXIT_BRANCH   // pc = cond ? target : fall
+};
+
+enum irCond : uint8_t {
+  COND_EQ_IMM, // a == imm
+  COND_NE_IMM,
+  COND_EQ,     // a == b
+  COND_NE,
+  COND_KEY,    // key[a] pressed
+  COND_NO_KEY
+};
+
+struct irExit {
+  irExitKind kind;
+  irCond cond;
+  uint8_t a, b;
+  uint8_t imm;
+  uint16_t target;
+  uint16_t fall; // BRANCH: not taken; CALL: return address
+};
+
+struct irBlock {
+  uint16_t start;
+  uint16_t instructions; // guest instructions, counting the exit's own
+  uint16_t lastOpcode;   // what cpu::opcode holds after the block
+  std::vector<irOp> ops;
+  irExit exit;
+  std::vector<uint16_t> code; // addresses of the instructions lifted
+};
+
+// Reads code for lifting; a cpu's memory, or a shared ROM image
+struct irSource {
+  const uint8_t *memory; // 4096 bytes
+  uint16_t fetch(uint16_t pc) const {
+    return memory[pc & 0xFFF] << 8 | memory[(pc + 1) & 0xFFF];
+  }
+};
+
+// Lifts the basic block at pc, up to maxInstructions long. False if its
+// first instruction is one the IR leaves to the interpreter (DXYN, FX0A).
+bool liftBlock(const irSource &src, uint16_t pc, int maxInstructions,
+               irBlock &block);
+
+// Passes. mergeBlocks extends a block through static jumps and calls while
+// it stays within maxInstructions; foldConstants propagates known values,
+// folding ops, branches and returns; removeDeadFlags drops writes nothing
+// reads before they are overwritten, which is mostly VF flags.
+void mergeBlocks(const irSource &src, irBlock &block, int maxInstructions);
+void foldConstants(irBlock &block);
+void removeDeadFlags(irBlock &block);
+
+// Lifts and runs every pass; false as for liftBlock
+bool compileBlock(const irSource &src, uint16_t pc, int maxInstructions,
+                  irBlock &block);
@@ -0,0 +1,83 @@
+#include "irprogram.h"
+#include "statefile.h"
+#include <cstring>
+#include <memory>
+#include <mutex>
+
+namespace {
+
+std::mutex registryLock;
+std::vector<std::unique_ptr<irProgram>> registry;
+
+} // namespace
+
+const irProgram *irProgram::shared(const cpu &boot, int maxInstructions) {
+  uint8_t memory[4096];
+  for (uint16_t addr = 0; addr < 4096; addr++) {
+    memory[addr] = boot.readMemory(addr);
+  }
+  uint64_t rom = romHash(boot);
+  std::lock_guard<std::mutex> guard(registryLock);
+  for (size_t i = 0; i < registry.size(); i++) {
+    const irProgram &p = *registry[i];
+    if (p.hash == rom && p.maxInstructions == maxInstructions &&
+        memcmp(p.image, memory, sizeof(memory)) == 0) {
+      return &p;
+    }
+  }
+  std::unique_ptr<irProgram> p(new irProgram);
+  p->hash = rom;
+  p->maxInstructions = maxInstructions;
+  p->build(memory);
+  registry.push_back(std::move(p));
+  return registry.back().get();
+}
+
+// Compiles every even address up front, so the program is complete before
+// any runner sees it and needs no locking afterwards
+void irProgram::build(const uint8_t *memory) {
+  memcpy(image, memory, sizeof(image));
+  irSource src = {image};
+  irBlock scratch;
+  std::vector<uint32_t> uses; // byte << 16 | block start, for each lifted byte
+  for (uint16_t pc = 0; pc < 4096; pc++) {
+    index[pc] = IR_NONE;
+  }
+  for (uint16_t pc = 0; pc < 4096; pc += 2) {
+    if (!compileBlock(src, pc, maxInstructions, scratch)) {
+      index[pc] = IR_INTERP;
+      uses.push_back((uint32_t)pc << 16 | pc);
+      uses.push_back((uint32_t)((pc + 1) & 0xFFF) << 16 | pc);
+      continue;
+    }
+    irCompiled b;
+    b.instructions = scratch.instructions;
+    b.lastOpcode = scratch.lastOpcode;
+    b.first = pool.size();
+    b.count = scratch.ops.size();
+    b.exit = scratch.exit;
+    pool.insert(pool.end(), scratch.ops.begin(), scratch.ops.end());
+    blockList.push_back(b);
+    index[pc] = blockList.size() - 1;
+    for (uint16_t addr : scratch.code) {
+      uses.push_back((uint32_t)(addr & 0xFFF) << 16 | pc);
+      uses.push_back((uint32_t)((addr + 1) & 0xFFF) << 16 | pc);
+    }
+  }
+
+  // group the starts by byte; a block lifting one address twice (a merged
+  // loop) is listed twice, which only costs a repeated store when stale
+  memset(coverFirst, 0, sizeof(coverFirst));
+  for (uint32_t u : uses) {
+    coverFirst[(u >> 16) + 1]++;
+  }
+  for (int addr = 0; addr < 4096; addr++) {
+    coverFirst[addr + 1] += coverFirst[addr];
+  }
+  covers.resize(uses.size());
+  uint32_t fill[4096];
+  memcpy(fill, coverFirst, sizeof(fill));
+  for (uint32_t u : uses) {
+    covers[fill[u >> 16]++] = (uint16_t)u;
+  }
+}
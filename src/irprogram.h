@@ -0,0 +1,53 @@
+#pragma once
+#include "cpu.h"
+#include "ir.h"
+#include <cstdint>
+#include <vector>
+
+// A block ready to run: its ops are count entries of a pool from first
+struct irCompiled {
+  uint16_t instructions;
+  uint16_t lastOpcode;
+  uint32_t first, count;
+  irExit exit;
+};
+
+const int32_t IR_NONE = -1;   // nothing compiled at this address yet
+const int32_t IR_INTERP = -2; // starts with an instruction left to cpu::step
+
+// Blocks compiled from one memory image at every even address, shared
+// read-only by all the runners executing that image, so a fleet of
+// instances of one ROM lifts and stores its code once. A program never
+// changes after it is built; an instance that writes over code it covers
+// stops using the affected blocks itself (see irRunner::attach).
+class irProgram {
+private:
+  std::vector<irCompiled> blockList;
+  std::vector<irOp> pool;
+  int32_t index[4096];       // block at each address, or IR_NONE/IR_INTERP
+  uint8_t image[4096];       // the memory the blocks were compiled from
+  uint32_t coverFirst[4097]; // covers[coverFirst[a]..coverFirst[a + 1]]
+  std::vector<uint16_t> covers; // start addresses of the blocks using byte a
+  uint64_t hash;
+  int maxInstructions;
+
+  void build(const uint8_t *memory);
+
+public:
+  // The program for boot's memory image and block cap, built by the first
+  // caller. Safe to call from any thread; programs live until exit.
+  static const irProgram *shared(const cpu &boot, int maxInstructions);
+
+  int32_t lookup(uint16_t pc) const { return index[pc & 0xFFF]; }
+  const irCompiled &block(int32_t n) const { return blockList[n]; }
+  const irOp *ops(const irCompiled &b) const { return &pool[b.first]; }
+  uint8_t original(uint16_t addr) const { return image[addr & 0xFFF]; }
+  // Start addresses of the blocks that lifted byte addr
+  const uint16_t *coverBegin(uint16_t addr) const {
+    return covers.data() + coverFirst[addr & 0xFFF];
+  }
+  const uint16_t *coverEnd(uint16_t addr) const {
+    return covers.data() + coverFirst[(addr & 0xFFF) + 1];
+  }
+  int blockCount() const { return (int)blockList.size(); }
+};
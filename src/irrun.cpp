@@ -0,0 +1,316 @@
+#include "irrun.h"
+#include <cstring>
+
+const int RESERVE_BLOCKS = 1024;
+const int RESERVE_OPS = 32 * 1024;
+
+// Hooks for instructions the runner leaves to cpu::step: notices writes to
+// compiled code
+struct irWatch {
+  irRunner &ir;
+  void onExecute(uint16_t) {}
+  void onRead(uint16_t) {}
+  void onWrite(uint16_t addr) { ir.written(addr); }
+};
+
+void irRunner::init(int maxBlock) {
+  maxInstructions = maxBlock;
+  blocks.reserve(RESERVE_BLOCKS);
+  pool.reserve(RESERVE_OPS);
+  scratch.ops.reserve(8 * maxBlock + 8);
+  scratch.code.reserve(maxBlock);
+  blockRuns = 0;
+  steps = 0;
+  program = nullptr;
+  memset(stale, 0, sizeof(stale));
+  flush();
+}
+
+void irRunner::attach(const irProgram *shared, const cpu &c) {
+  program = shared;
+  reset(c);
+}
+
+void irRunner::reset(const cpu &c) {
+  flush();
+  memset(stale, 0, sizeof(stale));
+  if (program == nullptr) {
+    return;
+  }
+  for (uint16_t addr = 0; addr < 4096; addr++) {
+    if (c.memory[addr] != program->original(addr)) {
+      written(addr);
+    }
+  }
+  dirty = false;
+}
+
+// A byte of memory is about to change or just has
+void irRunner::written(uint16_t addr) {
+  addr &= 0xFFF;
+  dirty |= code[addr] != 0;
+  if (program != nullptr) {
+    const uint16_t *end = program->coverEnd(addr);
+    for (const uint16_t *s = program->coverBegin(addr); s != end; s++) {
+      stale[*s] = 1;
+    }
+  }
+}
+
+void irRunner::flush() {
+  blocks.clear();
+  pool.clear();
+  for (int i = 0; i < 4096; i++) {
+    index[i] = IR_NONE;
+  }
+  memset(code, 0, sizeof(code));
+  dirty = false;
+}
+
+int32_t irRunner::compile(const cpu &c) {
+  irSource src = {c.memory};
+  if (!compileBlock(src, c.pc, maxInstructions, scratch)) {
+    index[c.pc] = IR_INTERP;
+    return IR_INTERP;
+  }
+  irCompiled b;
+  b.instructions = scratch.instructions;
+  b.lastOpcode = scratch.lastOpcode;
+  b.first = pool.size();
+  b.count = scratch.ops.size();
+  b.exit = scratch.exit;
+  pool.insert(pool.end(), scratch.ops.begin(), scratch.ops.end());
+  for (uint16_t addr : scratch.code) {
+    code[addr & 0xFFF] = 1;
+    code[(addr + 1) & 0xFFF] = 1;
+  }
+  blocks.push_back(b);
+  index[c.pc] = blocks.size() - 1;
+  return index[c.pc];
+}
+
+// The block to run at c.pc and its ops; nullptr to interpret
+const irCompiled *irRunner::lookup(const cpu &c, const irOp *&ops) {
+  if (program != nullptr && !stale[c.pc]) {
+    int32_t n = program->lookup(c.pc);
+    if (n >= 0) {
+      ops = program->ops(program->block(n));
+      return &program->block(n);
+    }
+    if (n == IR_INTERP) {
+      return nullptr;
+    }
+  }
+  int32_t n = index[c.pc];
+  if (n == IR_NONE) {
+    n = compile(c);
+  }
+  if (n < 0) {
+    return nullptr;
+  }
+  ops = &pool[blocks[n].first];
+  return &blocks[n];
+}
+
+void irRunner::run(const irCompiled &b, const irOp *ops, cpu &c) {
+  uint8_t r[IR_REGS];
+  memcpy(r, c.V, 16);
+  uint16_t I = c.I;
+  for (uint32_t n = 0; n < b.count; n++) {
+    const irOp &op = ops[n];
+    switch (op.code) {
+    case (IR_SET):
+      r[op.dst] = op.imm;
+      break;
+    // spelled out rather than through irEvaluate, to keep one dispatch
+    case (IR_MOV):
+      r[op.dst] = r[op.a];
+      break;
+    case (IR_ADD):
+      r[op.dst] = r[op.a] + r[op.b];
+      break;
+    case (IR_ADDK):
+      r[op.dst] = r[op.a] + op.imm;
+      break;
+    case (IR_SUB):
+      r[op.dst] = r[op.a] - r[op.b];
+      break;
+    case (IR_OR):
+      r[op.dst] = r[op.a] | r[op.b];
+      break;
+    case (IR_AND):
+      r[op.dst] = r[op.a] & r[op.b];
+      break;
+    case (IR_XOR):
+      r[op.dst] = r[op.a] ^ r[op.b];
+      break;
+    case (IR_SHR):
+      r[op.dst] = r[op.a] >> 1;
+      break;
+    case (IR_SHL):
+      r[op.dst] = r[op.a] << 1;
+      break;
+    case (IR_CARRY):
+      r[op.dst] = r[op.a] + r[op.b] > 255;
+      break;
+    case (IR_GE):
+      r[op.dst] = r[op.a] >= r[op.b];
+      break;
+    case (IR_BIT0):
+      r[op.dst] = r[op.a] & 1;
+      break;
+    case (IR_BIT7):
+      r[op.dst] = r[op.a] >> 7;
+      break;
+    case (IR_SETI):
+      I = op.imm;
+      break;
+    case (IR_ADDI):
+      I += r[op.a];
+      break;
+    case (IR_FONT):
+      I = r[op.a] * 5;
+      break;
+    case (IR_BCD): {
+      int number = r[op.a];
+      c.memory[I & 0xFFF] = number / 100;
+      c.memory[(I + 1) & 0xFFF] = (number / 10) % 10;
+      c.memory[(I + 2) & 0xFFF] = number % 10;
+      written(I);
+      written(I + 1);
+      written(I + 2);
+      break;
+    }
+    case (IR_STORE):
+      for (int i = 0; i <= op.imm; i++) {
+        c.memory[I & 0xFFF] = r[i];
+        written(I);
+        I++;
+      }
+      break;
+    case (IR_LOAD):
+      for (int i = 0; i <= op.imm; i++) {
+        r[i] = c.memory[I & 0xFFF];
+        I++;
+      }
+      break;
+    case (IR_GETDELAY):
+      r[op.dst] = c.delay_timer;
+      break;
+    case (IR_SETDELAY):
+      c.delay_timer = r[op.a];
+      break;
+    case (IR_SETSOUND):
+      c.sound_timer = r[op.a];
+      break;
+    case (IR_RAND):
+      c.rng ^= c.rng << 13; // xorshift32, as CXNN
+      c.rng ^= c.rng >> 17;
+      c.rng ^= c.rng << 5;
+      r[op.dst] = ((c.rng >> 8) & 0xFF) & op.imm;
+      break;
+    case (IR_CLS):
+      memset(c.gfx, 0, sizeof(c.gfx));
+      c.draw = true;
+      break;
+    case (IR_PUSH):
+      c.stack[c.sp] = op.imm;
+      c.sp = (c.sp + 1) & 0xF;
+      break;
+    case (IR_POP):
+      c.sp = (c.sp - 1) & 0xF;
+      break;
+    }
+  }
+  memcpy(c.V, r, 16);
+  c.I = I;
+
+  const irExit &exit = b.exit;
+  switch (exit.kind) {
+  case (EXIT_STOP):
+  case (EXIT_GOTO):
+    c.pc = exit.target;
+    break;
+  case (EXIT_CALL):
+    c.stack[c.sp] = exit.fall;
+    c.sp = (c.sp + 1) & 0xF;
+    c.pc = exit.target;
+    break;
+  case (EXIT_RET):
+    c.sp = (c.sp - 1) & 0xF;
+    c.pc = c.stack[c.sp];
+    break;
+  case (EXIT_JUMP_V0):
+    c.pc = exit.target + c.V[0];
+    break;
+  case (EXIT_BRANCH): {
+    bool taken;
+    switch (exit.cond) {
+    case (COND_EQ_IMM):
+      taken = c.V[exit.a] == exit.imm;
+      break;
+    case (COND_NE_IMM):
+      taken = c.V[exit.a] != exit.imm;
+      break;
+    case (COND_EQ):
+      taken = c.V[exit.a] == c.V[exit.b];
+      break;
+    case (COND_NE):
+      taken = c.V[exit.a] != c.V[exit.b];
+      break;
+    case (COND_KEY):
+      taken = c.key[c.V[exit.a]] != 0;
+      break;
+    default: // COND_NO_KEY
+      taken = c.key[c.V[exit.a]] == 0;
+      break;
+    }
+    c.pc = taken ? exit.target : exit.fall;
+    break;
+  }
+  }
+  c.opcode = b.lastOpcode;
+  c.keyWait = false;
+  c.breakIPF = false;
+}
+
+// Runs blocks back to back while the next one fits; only DXYN, FX0A and
+// the frame's last few instructions go through the interpreter
+int irRunner::step(cpu &c, int budget) {
+  int ran = 0;
+  const irOp *ops;
+  while (c.pc <= 0xFFF) {
+    const irCompiled *b = lookup(c, ops);
+    if (b == nullptr || b->instructions > budget - ran) {
+      break;
+    }
+    ran += b->instructions;
+    blockRuns++;
+    run(*b, ops, c);
+    if (dirty) {
+      flush();
+    }
+  }
+  if (ran > 0) {
+    return ran;
+  }
+  irWatch watch = {*this};
+  c.step(watch);
+  steps++;
+  if (dirty) {
+    flush();
+  }
+  return 1;
+}
+
+bool irRunner::runFrame(cpu &c, int ipf) {
+  c.vblank();
+  for (int i = 0; i < ipf;) {
+    i += step(c, ipf - i);
+    // a waiting FX0A would only run again until the frame ends
+    if (c.breakIPF || !c.running || c.keyWait) {
+      break;
+    }
+  }
+  return c.timers();
+}
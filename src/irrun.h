@@ -0,0 +1,62 @@
+#pragma once
+#include "cpu.h"
+#include "ir.h"
+#include "irprogram.h"
+#include <cstdint>
+#include <vector>
+
+// Executes a cpu through compiled IR blocks, one per start address, built
+// on first use. A block only runs when all its instructions fit in the
+// frame's remaining budget, so the cpu matches executeCycle at every frame
+// boundary; otherwise, and for DXYN and FX0A, the runner falls back to
+// cpu::step. Any write to privately compiled code drops those blocks.
+//
+// Attached to a shared irProgram, the runner takes blocks from it and only
+// compiles privately where the program has none (odd addresses) or where
+// this instance's memory no longer matches the image the program was built
+// from. Those blocks are marked stale for this runner alone; other
+// instances keep using them.
+//
+// Memory changed from outside cpu::step must be followed by reset().
+class irRunner {
+private:
+  std::vector<irCompiled> blocks;
+  std::vector<irOp> pool;
+  int32_t index[4096]; // private block at each address, IR_NONE/IR_INTERP
+  uint8_t code[4096];  // bytes lifted into some private block
+  const irProgram *program; // shared blocks, or nullptr
+  uint8_t stale[4096]; // shared blocks this instance has written over
+  bool dirty;          // private code was written; flush after the block
+  irBlock scratch;
+  int maxInstructions;
+  uint64_t blockRuns, steps;
+
+  friend struct irWatch;
+
+  int32_t compile(const cpu &c);
+  const irCompiled *lookup(const cpu &c, const irOp *&ops);
+  void run(const irCompiled &b, const irOp *ops, cpu &c);
+  void written(uint16_t addr);
+  void flush();
+
+public:
+  // Blocks are capped at maxBlock instructions; pass the IPF, since longer
+  // ones could never run
+  void init(int maxBlock);
+  // Shares program's blocks (nullptr: compile everything privately). c is
+  // the cpu about to run; memory it has changed from the image is
+  // invalidated for this runner.
+  void attach(const irProgram *shared, const cpu &c);
+  void reset(const cpu &c);
+  // Runs blocks while they fit in budget (> 0), or one instruction if
+  // none does. Returns the number of instructions executed.
+  int step(cpu &c, int budget);
+  // cpu::runFrame through step(); the same result, frame for frame
+  bool runFrame(cpu &c, int ipf);
+  uint64_t blocksRun() const { return blockRuns; }
+  uint64_t instructionsStepped() const { return steps; }
+  int blockCount() const { return (int)blocks.size(); } // private ones
+  int sharedBlockCount() const {
+    return program != nullptr ? program->blockCount() : 0;
+  }
+};
@@ -0,0 +1,152 @@
+#include "log.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace logging {
+
+std::atomic<int> level(CHIP8_LOG_LEVEL);
+
+const size_t BUFFER_SIZE = 16384;
+const int FLUSH_INTERVAL_MS = 50;
+
+namespace {
+
+// One per logging thread. The owning thread and the flusher are the only
+// users of the lock, so appends are effectively uncontended.
+struct threadBuffer {
+  std::mutex lock;
+  char data[BUFFER_SIZE];
+  size_t used = 0;
+  uint64_t dropped = 0; // records lost because the buffer was full
+};
+
+struct flusher {
+  std::mutex lock; // guards buffers and thread startup
+  std::vector<threadBuffer *> buffers;
+  std::condition_variable wake;
+  std::thread thread;
+  bool stopping = false;
+  char scratch[BUFFER_SIZE];
+
+  ~flusher() {
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      stopping = true;
+    }
+    wake.notify_all();
+    if (thread.joinable()) {
+      thread.join();
+    }
+    drainAll();
+  }
+
+  void start() {
+    if (!thread.joinable()) {
+      thread = std::thread([this] { run(); });
+    }
+  }
+
+  void run() {
+    std::unique_lock<std::mutex> guard(lock);
+    while (!stopping) {
+      wake.wait_for(guard, std::chrono::milliseconds(FLUSH_INTERVAL_MS));
+      guard.unlock();
+      drainAll();
+      guard.lock();
+    }
+  }
+
+  // Must not hold lock; takes it to walk the registered buffers
+  void drainAll() {
+    std::lock_guard<std::mutex> guard(lock);
+    for (size_t i = 0; i < buffers.size(); i++) {
+      drain(*buffers[i]);
+    }
+    fflush(stderr);
+  }
+
+  void drain(threadBuffer &buf) {
+    size_t used;
+    uint64_t dropped;
+    {
+      std::lock_guard<std::mutex> guard(buf.lock);
+      used = buf.used;
+      dropped = buf.dropped;
+      memcpy(scratch, buf.data, used);
+      buf.used = 0;
+      buf.dropped = 0;
+    }
+    fwrite(scratch, 1, used, stderr);
+    if (dropped) {
+      fprintf(stderr, "level=warn event=log_dropped records=%llu\n",
+              (unsigned long long)dropped);
+    }
+  }
+};
+
+flusher &theFlusher() {
+  static flusher f;
+  return f;
+}
+
+// Registers the thread's buffer on first use and drains it on thread exit
+struct threadSlot {
+  threadBuffer *buf;
+  threadSlot() : buf(new threadBuffer) {
+    flusher &f = theFlusher();
+    std::lock_guard<std::mutex> guard(f.lock);
+    f.buffers.push_back(buf);
+    f.start();
+  }
+  ~threadSlot() {
+    flusher &f = theFlusher();
+    std::lock_guard<std::mutex> guard(f.lock);
+    f.drain(*buf);
+    f.buffers.erase(std::find(f.buffers.begin(), f.buffers.end(), buf));
+    delete buf;
+  }
+};
+
+threadBuffer &localBuffer() {
+  thread_local threadSlot slot;
+  return *slot.buf;
+}
+
+} // namespace
+
+void record::append(std::string_view text) {
+  size_t n = std::min(text.size(), RECORD_MAX - 1 - len);
+  memcpy(data + len, text.data(), n);
+  len += n;
+}
+
+void begin(record &r, int lvl, std::string_view event) {
+  static const char *names[] = {"trace", "debug", "info", "warn", "error"};
+  r.len = 0;
+  r.append("level=");
+  r.append(names[lvl < 0 ? 0 : lvl > 4 ? 4 : lvl]);
+  r.append(" event=");
+  r.append(event);
+}
+
+void submit(record &r) {
+  r.data[r.len++] = '\n'; // append() always leaves room for this
+  threadBuffer &buf = localBuffer();
+  std::lock_guard<std::mutex> guard(buf.lock);
+  if (buf.used + r.len > BUFFER_SIZE) {
+    buf.dropped++;
+    return;
+  }
+  memcpy(buf.data + buf.used, r.data, r.len);
+  buf.used += r.len;
+}
+
+void flush() { theFlusher().drainAll(); }
+
+} // namespace logging
@@ -0,0 +1,135 @@
+#pragma once
+#include <atomic>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <type_traits>
+
+// Leveled, structured (logfmt) logging:
+//   LOG_ERROR("rom_too_big", "path", name, "size", size);
+// Levels below CHIP8_LOG_LEVEL expand to nothing, arguments included, so
+// trace calls can sit in the interpreter's hot path. Enabled calls format
+// into a per-thread buffer without locking other threads or allocating;
+// a background thread writes the buffers to stderr.
+
+#define LOG_LEVEL_TRACE 0
+#define LOG_LEVEL_DEBUG 1
+#define LOG_LEVEL_INFO 2
+#define LOG_LEVEL_WARN 3
+#define LOG_LEVEL_ERROR 4
+#define LOG_LEVEL_NONE 5
+
+#ifndef CHIP8_LOG_LEVEL
+#define CHIP8_LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+#if CHIP8_LOG_LEVEL <= LOG_LEVEL_TRACE
+#define LOG_TRACE(...) logging::write(LOG_LEVEL_TRACE, __VA_ARGS__)
+#else
+#define LOG_TRACE(...) ((void)0)
+#endif
+#if CHIP8_LOG_LEVEL <= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(...) logging::write(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define LOG_DEBUG(...) ((void)0)
+#endif
+#if CHIP8_LOG_LEVEL <= LOG_LEVEL_INFO
+#define LOG_INFO(...) logging::write(LOG_LEVEL_INFO, __VA_ARGS__)
+#else
+#define LOG_INFO(...) ((void)0)
+#endif
+#if CHIP8_LOG_LEVEL <= LOG_LEVEL_WARN
+#define LOG_WARN(...) logging::write(LOG_LEVEL_WARN, __VA_ARGS__)
+#else
+#define LOG_WARN(...) ((void)0)
+#endif
+#if CHIP8_LOG_LEVEL <= LOG_LEVEL_ERROR
+#define LOG_ERROR(...) logging::write(LOG_LEVEL_ERROR, __VA_ARGS__)
+#else
+#define LOG_ERROR(...) ((void)0)
+#endif
+
+namespace logging {
+
+const size_t RECORD_MAX = 256; // longer records are truncated
+
+// Runtime threshold; can only raise the compile-time one
+extern std::atomic<int> level;
+
+// Formats an integer field as 0x-prefixed hex
+struct hex {
+  uint32_t value;
+  explicit hex(uint32_t v) : value(v) {}
+};
+
+struct record {
+  char data[RECORD_MAX];
+  size_t len = 0;
+  void append(std::string_view text);
+  void append(char c) {
+    if (len < RECORD_MAX - 1) {
+      data[len++] = c;
+    }
+  }
+};
+
+void begin(record &r, int lvl, std::string_view event);
+void submit(record &r);
+
+inline void appendValue(record &r, std::string_view text) {
+  bool quote = text.empty() || text.find_first_of(" =\"") != text.npos;
+  if (quote) {
+    r.append('"');
+  }
+  r.append(text);
+  if (quote) {
+    r.append('"');
+  }
+}
+inline void appendValue(record &r, const char *text) {
+  appendValue(r, std::string_view(text ? text : "(null)"));
+}
+inline void appendValue(record &r, bool value) {
+  r.append(value ? "true" : "false");
+}
+inline void appendValue(record &r, hex value) {
+  char buf[16] = {'0', 'x'};
+  std::to_chars_result res = std::to_chars(buf + 2, buf + sizeof(buf),
+                                           value.value, 16);
+  r.append(std::string_view(buf, res.ptr - buf));
+}
+template <class T>
+typename std::enable_if<std::is_arithmetic<T>::value>::type
+appendValue(record &r, T value) {
+  char buf[32];
+  std::to_chars_result res = std::to_chars(buf, buf + sizeof(buf), value);
+  r.append(std::string_view(buf, res.ptr - buf));
+}
+
+inline void appendFields(record &) {}
+template <class V, class... Rest>
+void appendFields(record &r, std::string_view key, const V &value,
+                  const Rest &...rest) {
+  r.append(' ');
+  r.append(key);
+  r.append('=');
+  appendValue(r, value);
+  appendFields(r, rest...);
+}
+
+template <class... Fields>
+void write(int lvl, std::string_view event, const Fields &...fields) {
+  if (lvl < level.load(std::memory_order_relaxed)) {
+    return;
+  }
+  record r;
+  begin(r, lvl, event);
+  appendFields(r, fields...);
+  submit(r);
+}
+
+// Writes everything logged so far; called automatically on exit
+void flush();
+
+} // namespace logging
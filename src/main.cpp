@@ -1,4 +1,19 @@
+#include "alloccount.h"
 #include "cpu.h"
+#include "debugger.h"
+#include "display.h"
+#include "emulation.h"
+#include "gdbstub.h"
+#include "heatmap.h"
+#include "irrun.h"
+#include "log.h"
+#include "memo.h"
+#include "montecarlo.h"
+#include "snapshot.h"
+#include "statefile.h"
+#include "sweep.h"
+#include "timeline.h"
+#include "vip.h"
 #include <SDL3/SDL.h>
 #include <SDL3/SDL_audio.h>
 #include <SDL3/SDL_events.h>
@@ -7,11 +22,220 @@
 #include <SDL3/SDL_render.h>
 #include <SDL3/SDL_scancode.h>
 #include <SDL3/SDL_timer.h>
+#include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <ctime>
+#include <string>
 
 const int WINDOW_SCALE = 20;
 const int IPF = 15;
+const Uint64 FRAME_NS = SDL_NS_PER_SECOND / 60;
+const int MAX_FRAMESKIP = 4;                 // always present at least 1 in 5
+const Uint64 MAX_LAG_NS = SDL_NS_PER_SECOND / 4; // beyond this, drop time
+const Uint64 LATCH_MARGIN_NS = SDL_NS_PER_MS; // vsync: slack before vblank
+const Uint64 ALLOC_WARMUP_FRAMES = 120; // allocations after this are a bug
+const long MONTE_CARLO_FRAMES = 60 * 60; // per seed unless --headless says
+const long VIP_COMPARE_FRAMES = 60 * 60;
+
+struct frameStats {
+  Uint64 emulated;  // frames run by the cpu
+  Uint64 presented; // frames uploaded and presented
+  Uint64 skipped;   // frames with pending changes not rendered due to load
+  Uint64 dropped;   // frames of wall time given up after falling too far behind
+};
+
+struct options {
+  const char *romName;
+  phosphorMode phosphor;
+  quirkProfile profile;
+  bool profileGiven; // --profile was passed, so it overrides a restore
+  bool vsync; // present on vblank and latch input as late as possible
+  int gdbPort; // 0 = no gdb stub
+  bool rewind; // record the session for reverse stepping
+  const char *heatmapPrefix; // write PREFIX.ppm and PREFIX.map on exit
+  long headlessFrames; // > 0: run this many frames without a window, then exit
+  bool allocCheck; // fail if the frame loop allocates after warmup
+  const char *statePath; // resume from and keep saving to this file
+  const char *snapshotDir; // boot snapshot cache, NULL = off
+  snapshotTrigger snapshotAt;
+  long monteCarloSeeds; // > 0: run this many seeds headless and report
+  long seedBase;
+  int threads; // Monte Carlo workers, 0 = one per hardware thread
+  const char *scriptPath; // input script for Monte Carlo runs
+  scoreLocation score;
+  const char *sweepPath; // run a sweep matrix across worker processes
+  int workers; // sweep processes, 0 = one per cpu
+  const char *checkpointPath; // sweep progress, resumed if it exists
+  simdLevel simd; // widest display kernels to use
+  bool memo; // headless: replay pure subroutine calls
+  bool ir;   // headless and Monte Carlo: run compiled IR blocks
+  bool vipTiming; // frames are VIP machine cycles, not IPF instructions;
+                  // the debugger and heatmap still run IPF frames
+  const char *vipInterpreter; // compare against the VIP running this image
+  const char *vipMonitor;     // VIP monitor ROM for the comparison
+};
+
+bool parseArgs(int argc, char *argv[], options &opts, debugger &dbg) {
+  opts.romName = NULL;
+  opts.phosphor = PHOSPHOR_OFF;
+  opts.profile = PROFILE_VIP;
+  opts.profileGiven = false;
+  opts.vsync = false;
+  opts.gdbPort = 0;
+  opts.rewind = false;
+  opts.heatmapPrefix = NULL;
+  opts.headlessFrames = 0;
+  opts.allocCheck = false;
+  opts.statePath = NULL;
+  opts.snapshotDir = NULL;
+  opts.snapshotAt.kind = snapshotTrigger::AT_FRAME;
+  opts.snapshotAt.value = 600;
+  opts.monteCarloSeeds = 0;
+  opts.seedBase = 1;
+  opts.threads = 0;
+  opts.scriptPath = NULL;
+  opts.score.enabled = false;
+  opts.sweepPath = NULL;
+  opts.workers = 0;
+  opts.checkpointPath = NULL;
+  opts.simd = SIMD_AVX512;
+  opts.memo = false;
+  opts.ir = false;
+  opts.vipTiming = false;
+  opts.vipInterpreter = NULL;
+  opts.vipMonitor = NULL;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--phosphor") == 0 && i + 1 < argc) {
+      const char *mode = argv[++i];
+      if (strcmp(mode, "decay") == 0) {
+        opts.phosphor = PHOSPHOR_DECAY;
+      } else if (strcmp(mode, "or") == 0) {
+        opts.phosphor = PHOSPHOR_OR;
+      } else if (strcmp(mode, "off") != 0) {
+        LOG_ERROR("unknown_phosphor_mode", "mode", mode);
+        return false;
+      }
+    } else if (strcmp(argv[i], "--break") == 0 && i + 1 < argc) {
+      if (!parseBreakpoint(dbg, argv[++i])) {
+        LOG_ERROR("bad_breakpoint", "spec", argv[i]);
+        return false;
+      }
+    } else if (strcmp(argv[i], "--watch") == 0 && i + 1 < argc) {
+      if (!parseWatchpoint(dbg, argv[++i])) {
+        LOG_ERROR("bad_watchpoint", "spec", argv[i]);
+        return false;
+      }
+    } else if (strcmp(argv[i], "--gdb") == 0 && i + 1 < argc) {
+      opts.gdbPort = atoi(argv[++i]);
+      if (opts.gdbPort <= 0 || opts.gdbPort > 65535) {
+        LOG_ERROR("bad_gdb_port", "port", argv[i]);
+        return false;
+      }
+    } else if (strcmp(argv[i], "--heatmap") == 0 && i + 1 < argc) {
+      opts.heatmapPrefix = argv[++i];
+    } else if (strcmp(argv[i], "--headless") == 0 && i + 1 < argc) {
+      opts.headlessFrames = atol(argv[++i]);
+      if (opts.headlessFrames <= 0) {
+        LOG_ERROR("bad_frame_count", "frames", argv[i]);
+        return false;
+      }
+    } else if (strcmp(argv[i], "--state") == 0 && i + 1 < argc) {
+      opts.statePath = argv[++i];
+    } else if (strcmp(argv[i], "--snapshot-dir") == 0 && i + 1 < argc) {
+      opts.snapshotDir = argv[++i];
+    } else if (strcmp(argv[i], "--snapshot-at") == 0 && i + 1 < argc) {
+      if (!parseSnapshotTrigger(argv[++i], opts.snapshotAt)) {
+        LOG_ERROR("bad_snapshot_trigger", "spec", argv[i]);
+        return false;
+      }
+    } else if (strcmp(argv[i], "--montecarlo") == 0 && i + 1 < argc) {
+      opts.monteCarloSeeds = atol(argv[++i]);
+      if (opts.monteCarloSeeds <= 0) {
+        LOG_ERROR("bad_seed_count", "seeds", argv[i]);
+        return false;
+      }
+    } else if (strcmp(argv[i], "--seed-base") == 0 && i + 1 < argc) {
+      opts.seedBase = atol(argv[++i]);
+    } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+      opts.threads = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--script") == 0 && i + 1 < argc) {
+      opts.scriptPath = argv[++i];
+    } else if (strcmp(argv[i], "--score") == 0 && i + 1 < argc) {
+      if (!parseScoreLocation(argv[++i], opts.score)) {
+        LOG_ERROR("bad_score_location", "spec", argv[i]);
+        return false;
+      }
+    } else if (strcmp(argv[i], "--sweep") == 0 && i + 1 < argc) {
+      opts.sweepPath = argv[++i];
+    } else if (strcmp(argv[i], "--checkpoint") == 0 && i + 1 < argc) {
+      opts.checkpointPath = argv[++i];
+    } else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+      opts.workers = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--simd") == 0 && i + 1 < argc) {
+      if (!parseSimdLevel(argv[++i], opts.simd)) {
+        LOG_ERROR("unknown_simd_level", "level", argv[i]);
+        return false;
+      }
+    } else if (strcmp(argv[i], "--memo") == 0) {
+      opts.memo = true;
+    } else if (strcmp(argv[i], "--ir") == 0) {
+      opts.ir = true;
+    } else if (strcmp(argv[i], "--vip-timing") == 0) {
+      opts.vipTiming = true;
+    } else if (strcmp(argv[i], "--vip-compare") == 0 && i + 1 < argc) {
+      opts.vipInterpreter = argv[++i];
+    } else if (strcmp(argv[i], "--vip-monitor") == 0 && i + 1 < argc) {
+      opts.vipMonitor = argv[++i];
+    } else if (strcmp(argv[i], "--alloc-check") == 0) {
+      if (!alloccount::enabled()) {
+        LOG_ERROR("alloc_check_not_built", "build",
+                  "make alloccheck");
+        return false;
+      }
+      opts.allocCheck = true;
+    } else if (strcmp(argv[i], "--rewind") == 0) {
+      opts.rewind = true;
+    } else if (strcmp(argv[i], "--vsync") == 0) {
+      opts.vsync = true;
+    } else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc) {
+      const char *profile = argv[++i];
+      if (strcmp(profile, "vip") == 0) {
+        opts.profile = PROFILE_VIP;
+      } else if (strcmp(profile, "schip") == 0) {
+        opts.profile = PROFILE_SCHIP;
+      } else if (strcmp(profile, "xochip") == 0) {
+        opts.profile = PROFILE_XOCHIP;
+      } else {
+        LOG_ERROR("unknown_quirk_profile", "profile", profile);
+        return false;
+      }
+      opts.profileGiven = true;
+    } else if (argv[i][0] == '-') {
+      LOG_ERROR("unknown_option", "option", argv[i]);
+      return false;
+    } else {
+      opts.romName = argv[i];
+    }
+  }
+  if (opts.memo && opts.ir) {
+    LOG_ERROR("options_conflict", "options", "--memo --ir");
+    return false;
+  }
+  // these all replay or batch frames of IPF instructions
+  if (opts.vipTiming && (opts.memo || opts.ir || opts.rewind ||
+                         opts.snapshotDir != NULL ||
+                         opts.monteCarloSeeds > 0 || opts.sweepPath != NULL)) {
+    LOG_ERROR("options_conflict", "option", "--vip-timing", "with",
+              "--memo --ir --rewind --snapshot-dir --montecarlo --sweep");
+    return false;
+  }
+  if (opts.romName == NULL && opts.sweepPath == NULL) {
+    LOG_ERROR("no_rom", "usage", "chip8 ROM [options]");
+    return false;
+  }
+  return true;
+}
 
 SDL_Window *initWindow() {
   SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO);
@@ -24,218 +248,637 @@ SDL_Window *initWindow() {
   // Check that the window was successfully created
   if (window == NULL) {
     // In the case that the window could not be made...
-    SDL_LogError(SDL_LOG_CATEGORY_ERROR, "Could not create window: %s\n",
-                 SDL_GetError());
+    LOG_ERROR("window_create_failed", "error", SDL_GetError());
     return NULL;
   }
   return window;
 }
 
-int main(int argc, char *argv[]) {
-  srand(time(0));
-  if (argc == 1) {
-    SDL_Log("ERROR: enter name of rom to run");
-    return 1;
+// Uploads the composited display to the streaming texture and presents it
+void renderFrame(SDL_Renderer *renderer, SDL_Texture *texture,
+                 const uint8_t *intensity) {
+  void *pixels;
+  int pitch;
+  if (SDL_LockTexture(texture, NULL, &pixels, &pitch)) {
+    expandPixels(intensity, pixels, pitch);
+    SDL_UnlockTexture(texture);
   }
-  const char *romName = argv[1];
+  SDL_RenderClear(renderer);
+  SDL_RenderTexture(renderer, texture, NULL, NULL);
+  SDL_RenderPresent(renderer);
+}
 
-  cpu cpu;
-  cpu.init();
-  if (!cpu.loadRom(romName)) {
-    cpu.running = false;
-    return 1;
-    // error already logged
+// Latches last frame's keys and applies pending SDL events to the cpu.
+// F5 continues and F10 single-steps when the debugger is stopped, unless a
+// remote debugger is in control. With a timeline, F6/F7 step back a frame or
+// instruction, F8 steps forward an instruction and F9 resumes.
+void pollInput(cpu &cpu, debugger &dbg, bool debugKeys, timeline *travel) {
+  SDL_Event event;
+  // set previous keys
+  for (int i = 0; i < 16; i++) {
+    cpu.prevKeys[i] = cpu.key[i];
   }
-
-  SDL_Window *window = initWindow();
-  if (window == NULL) {
-    // Handle the error, already logged by createWindow
-    SDL_Quit();
-    return 1;
-  }
-
-  SDL_Renderer *renderer = SDL_CreateRenderer(window, NULL);
-  SDL_Texture *texture = SDL_CreateTexture(
-      renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET,
-      64 * WINDOW_SCALE, 32 * WINDOW_SCALE);
-
-  SDL_SetRenderTarget(renderer, texture);
-
-  // TODO: audio
-  SDL_AudioSpec audioSpec;
-  audioSpec.format = SDL_AUDIO_S8;
-  audioSpec.channels = 1;
-  audioSpec.freq = 48000;
-
-  SDL_AudioStream *audioStream = SDL_OpenAudioDeviceStream(
-      SDL_AUDIO_DEVICE_DEFAULT_PLAYBACK, &audioSpec, NULL, NULL);
-
-  SDL_ResumeAudioStreamDevice(audioStream);
-  SDL_PutAudioStreamData(audioStream, NULL, 800);
-
-  while (cpu.running) {
-    SDL_Event event;
-    // set previous keys
-    for (int i = 0; i < 16; i++) {
-      cpu.prevKeys[i] = cpu.key[i];
-    }
-    while (SDL_PollEvent(&event)) {
-      switch (event.type) {
-      case (SDL_EVENT_QUIT):
-        cpu.running = false;
-        break;
-      case (SDL_EVENT_KEY_DOWN): {
-        for (int i = 0; i < 16; i++) {
-        }
-        switch (event.key.scancode) {
-          {
-          case (SDL_SCANCODE_1):
-            cpu.keyDown(0x1);
-            break;
-          case (SDL_SCANCODE_2):
-            cpu.keyDown(0x2);
-            break;
-          case (SDL_SCANCODE_3):
-            cpu.keyDown(0x3);
-            break;
-          case (SDL_SCANCODE_4):
-            cpu.keyDown(0xC);
-            break;
-          case (SDL_SCANCODE_Q):
-            cpu.keyDown(0x4);
-            break;
-          case (SDL_SCANCODE_W):
-            cpu.keyDown(0x5);
-            break;
-          case (SDL_SCANCODE_E):
-            cpu.keyDown(0x6);
-            break;
-          case (SDL_SCANCODE_R):
-            cpu.keyDown(0xD);
-            break;
-          case (SDL_SCANCODE_A):
-            cpu.keyDown(0x7);
-            break;
-          case (SDL_SCANCODE_S):
-            cpu.keyDown(0x8);
-            break;
-          case (SDL_SCANCODE_D):
-            cpu.keyDown(0x9);
-            break;
-          case (SDL_SCANCODE_F):
-            cpu.keyDown(0xE);
-            break;
-          case (SDL_SCANCODE_Z):
-            cpu.keyDown(0xA);
-            break;
-          case (SDL_SCANCODE_X):
-            cpu.keyDown(0x0);
-            break;
-          case (SDL_SCANCODE_C):
-            cpu.keyDown(0xB);
-            break;
-          case (SDL_SCANCODE_V):
-            cpu.keyDown(0xF);
-            break;
-          case (SDL_SCANCODE_ESCAPE): {
-            SDL_DestroyWindow(window);
-            SDL_Quit();
-            return 0;
-            break;
-          }
-          default:
-            break;
-          }
-        }
-        break;
+  while (SDL_PollEvent(&event)) {
+    switch (event.type) {
+    case (SDL_EVENT_QUIT):
+      cpu.running = false;
+      break;
+    case (SDL_EVENT_KEY_DOWN): {
+      for (int i = 0; i < 16; i++) {
       }
-      case (SDL_EVENT_KEY_UP): {
-        switch (event.key.scancode) {
+      switch (event.key.scancode) {
+        {
         case (SDL_SCANCODE_1):
-          cpu.keyUp(0x1);
+          cpu.keyDown(0x1);
           break;
         case (SDL_SCANCODE_2):
-          cpu.keyUp(0x2);
+          cpu.keyDown(0x2);
           break;
         case (SDL_SCANCODE_3):
-          cpu.keyUp(0x3);
+          cpu.keyDown(0x3);
           break;
         case (SDL_SCANCODE_4):
-          cpu.keyUp(0xC);
+          cpu.keyDown(0xC);
           break;
         case (SDL_SCANCODE_Q):
-          cpu.keyUp(0x4);
+          cpu.keyDown(0x4);
           break;
         case (SDL_SCANCODE_W):
-          cpu.keyUp(0x5);
+          cpu.keyDown(0x5);
           break;
         case (SDL_SCANCODE_E):
-          cpu.keyUp(0x6);
+          cpu.keyDown(0x6);
           break;
         case (SDL_SCANCODE_R):
-          cpu.keyUp(0xD);
+          cpu.keyDown(0xD);
           break;
         case (SDL_SCANCODE_A):
-          cpu.keyUp(0x7);
+          cpu.keyDown(0x7);
           break;
         case (SDL_SCANCODE_S):
-          cpu.keyUp(0x8);
+          cpu.keyDown(0x8);
           break;
         case (SDL_SCANCODE_D):
-          cpu.keyUp(0x9);
+          cpu.keyDown(0x9);
           break;
         case (SDL_SCANCODE_F):
-          cpu.keyUp(0xE);
+          cpu.keyDown(0xE);
           break;
         case (SDL_SCANCODE_Z):
-          cpu.keyUp(0xA);
+          cpu.keyDown(0xA);
           break;
         case (SDL_SCANCODE_X):
-          cpu.keyUp(0x0);
+          cpu.keyDown(0x0);
           break;
         case (SDL_SCANCODE_C):
-          cpu.keyUp(0xB);
+          cpu.keyDown(0xB);
           break;
         case (SDL_SCANCODE_V):
-          cpu.keyUp(0xF);
+          cpu.keyDown(0xF);
+          break;
+        case (SDL_SCANCODE_F5):
+          if (debugKeys && dbg.isStopped()) {
+            dbg.resume();
+          }
           break;
+        case (SDL_SCANCODE_F10):
+          if (debugKeys && dbg.isStopped()) {
+            dbg.stepInstruction();
+          }
+          break;
+        case (SDL_SCANCODE_F6):
+        case (SDL_SCANCODE_F7):
+        case (SDL_SCANCODE_F8): {
+          if (travel == NULL) {
+            break;
+          }
+          SDL_Scancode code = event.key.scancode;
+          bool moved = (code == SDL_SCANCODE_F6) ? travel->stepBackFrame(cpu)
+                       : (code == SDL_SCANCODE_F7)
+                           ? travel->stepBackInstruction(cpu)
+                           : travel->stepForwardInstruction(cpu);
+          if (moved) {
+            LOG_INFO("rewind", "frame", travel->frame(), "instruction",
+                     travel->instruction());
+          }
+          break;
+        }
+        case (SDL_SCANCODE_F9):
+          if (travel != NULL && travel->isPaused()) {
+            travel->resume(cpu);
+          }
+          break;
+        case (SDL_SCANCODE_ESCAPE): {
+          cpu.running = false;
+          break;
+        }
         default:
           break;
         }
+      }
+      break;
+    }
+    case (SDL_EVENT_KEY_UP): {
+      switch (event.key.scancode) {
+      case (SDL_SCANCODE_1):
+        cpu.keyUp(0x1);
+        break;
+      case (SDL_SCANCODE_2):
+        cpu.keyUp(0x2);
+        break;
+      case (SDL_SCANCODE_3):
+        cpu.keyUp(0x3);
+        break;
+      case (SDL_SCANCODE_4):
+        cpu.keyUp(0xC);
+        break;
+      case (SDL_SCANCODE_Q):
+        cpu.keyUp(0x4);
+        break;
+      case (SDL_SCANCODE_W):
+        cpu.keyUp(0x5);
+        break;
+      case (SDL_SCANCODE_E):
+        cpu.keyUp(0x6);
+        break;
+      case (SDL_SCANCODE_R):
+        cpu.keyUp(0xD);
+        break;
+      case (SDL_SCANCODE_A):
+        cpu.keyUp(0x7);
         break;
+      case (SDL_SCANCODE_S):
+        cpu.keyUp(0x8);
+        break;
+      case (SDL_SCANCODE_D):
+        cpu.keyUp(0x9);
+        break;
+      case (SDL_SCANCODE_F):
+        cpu.keyUp(0xE);
+        break;
+      case (SDL_SCANCODE_Z):
+        cpu.keyUp(0xA);
+        break;
+      case (SDL_SCANCODE_X):
+        cpu.keyUp(0x0);
+        break;
+      case (SDL_SCANCODE_C):
+        cpu.keyUp(0xB);
+        break;
+      case (SDL_SCANCODE_V):
+        cpu.keyUp(0xF);
+        break;
+      default:
+        break;
+      }
+      break;
+    }
+    }
+  }
+}
+
+// Drains pending SDL events without touching the cpu, for while the gdb stub
+// holds it. Returns true if the window was closed or escape pressed.
+bool pollQuit() {
+  SDL_Event event;
+  bool quit = false;
+  while (SDL_PollEvent(&event)) {
+    if (event.type == SDL_EVENT_QUIT ||
+        (event.type == SDL_EVENT_KEY_DOWN &&
+         event.key.scancode == SDL_SCANCODE_ESCAPE)) {
+      quit = true;
+    }
+  }
+  return quit;
+}
+
+// Compares the allocation count against the post-warmup baseline. Returns
+// false, after logging, if the frame loop allocated in steady state.
+bool checkAllocations(Uint64 frames, uint64_t baseline) {
+  if (frames <= ALLOC_WARMUP_FRAMES) {
+    LOG_WARN("alloc_check_too_short", "warmup_frames", ALLOC_WARMUP_FRAMES);
+    return true;
+  }
+  uint64_t steady = alloccount::allocations() - baseline;
+  LOG_INFO("alloc_check", "allocations", steady, "frames",
+           frames - ALLOC_WARMUP_FRAMES);
+  return steady == 0;
+}
+
+// Runs the emulation, compositing, hashing and pixel conversion of the frame
+// loop without a window, as fast as possible. Used for soak runs and the
+// allocation check on machines without a display. With --rewind the session
+// is recorded as well, so the recording is soaked and checked too.
+int runHeadless(cpu &cpu, const options &opts, stateFile &state,
+                bootSnapshot &boot) {
+  static uint32_t pixels[DISPLAY_SIZE];
+  phosphor phosphor;
+  phosphor.init(opts.phosphor);
+  subroutineMemo memo;
+  irRunner ir;
+  vipClock clock;
+  emulation session;
+  if (opts.vipTiming) {
+    clock.init();
+    session = runSession(cpu, clock);
+  } else if (opts.memo) {
+    memo.init();
+    session = runSession(cpu, IPF, memo);
+  } else if (opts.ir) {
+    ir.init(IPF);
+    ir.attach(irProgram::shared(cpu, IPF), cpu);
+    session = runSession(cpu, IPF, ir);
+  } else {
+    session = runSession(cpu, IPF);
+  }
+  timeline travel;
+  if (opts.rewind) {
+    travel.init(IPF);
+  }
+  uint64_t baseline = 0;
+  uint64_t hash = 0;
+  Uint64 frames = 0;
+  while (cpu.running && frames < (Uint64)opts.headlessFrames) {
+    for (int i = 0; i < 16; i++) {
+      cpu.prevKeys[i] = cpu.key[i];
+    }
+    if (opts.rewind) {
+      travel.record(cpu);
+    }
+    if (boot.pending()) {
+      boot.runFrame(cpu, IPF);
+      // the memo and IR blocks only see writes made through them
+      memo.reset();
+      ir.reset(cpu);
+    } else {
+      session.runFrame();
+    }
+    state.save(cpu);
+    if (cpu.draw || phosphor.active()) {
+      phosphor.compose(cpu.gfx);
+      hash = hashDisplay(phosphor.intensity);
+      expandPixels(phosphor.intensity, pixels, DISPLAY_WIDTH * 4);
+      cpu.draw = false;
+    }
+    frames++;
+    if (frames == ALLOC_WARMUP_FRAMES) {
+      baseline = alloccount::allocations();
+    }
+  }
+  char display[17];
+  snprintf(display, sizeof(display), "%016llx", (unsigned long long)hash);
+  LOG_INFO("headless", "frames", frames, "display", display);
+  if (opts.memo) {
+    LOG_INFO("memo", "routines", memo.routineCount(), "hits", memo.hits(),
+             "skipped", memo.instructionsSkipped());
+  }
+  if (opts.ir) {
+    LOG_INFO("ir", "shared_blocks", ir.sharedBlockCount(), "private_blocks",
+             ir.blockCount(), "block_runs", ir.blocksRun(), "stepped",
+             ir.instructionsStepped());
+  }
+  if (opts.vipTiming) {
+    LOG_INFO("vip_timing", "cycles", clock.cycles(), "instructions",
+             clock.instructions());
+  }
+  if (cpu.badOpcode != 0) {
+    LOG_ERROR("bad_opcode", "opcode", logging::hex(cpu.badOpcode));
+    state.discard();
+  }
+  if (opts.allocCheck && !checkAllocations(frames, baseline)) {
+    return 1;
+  }
+  return 0;
+}
+
+// Runs the ROM across many CXNN seeds with the same input and prints the
+// distribution of outcomes
+int runMonteCarloReport(const cpu &boot, const options &opts) {
+  inputScript script;
+  if (opts.scriptPath != NULL && !script.load(opts.scriptPath)) {
+    return 1;
+  }
+  monteCarloConfig config;
+  config.firstSeed = opts.seedBase;
+  config.seeds = opts.monteCarloSeeds;
+  config.frames =
+      opts.headlessFrames > 0 ? opts.headlessFrames : MONTE_CARLO_FRAMES;
+  config.ipf = IPF;
+  config.threads = opts.threads;
+  config.score = opts.score;
+  config.ir = opts.ir;
+
+  Uint64 start = SDL_GetTicksNS();
+  monteCarloResult r =
+      summarize(runMonteCarlo(boot, script, config), opts.score.enabled);
+  double seconds = (SDL_GetTicksNS() - start) / 1e9;
+
+  logging::flush(); // the report goes after anything logged on the way
+  printf("runs      %llu (seeds %u-%u) in %.2fs\n", (unsigned long long)r.runs,
+         config.firstSeed, config.firstSeed + config.seeds - 1, seconds);
+  printf("crashed   %llu (%.2f%%)\n", (unsigned long long)r.crashes,
+         100.0 * r.crashes / r.runs);
+  printf("finished  %llu (%.2f%%)\n", (unsigned long long)r.finished,
+         100.0 * r.finished / r.runs);
+  printf("frames    mean %.1f min %u max %u\n",
+         (double)r.framesTotal / r.runs, r.framesMin, r.framesMax);
+  if (opts.score.enabled) {
+    printf("score     mean %.2f sd %.2f min %u p10 %u p50 %u p90 %u max %u\n",
+           r.scoreMean, r.scoreStddev, r.scoreMin, r.scoreP10, r.scoreP50,
+           r.scoreP90, r.scoreMax);
+  }
+  return 0;
+}
+
+// Runs the ROM on the cpu class and on an emulated VIP in lockstep and
+// reports the first instruction where they disagree
+int runVipComparison(const cpu &boot, const options &opts) {
+  static vipMachine vip;
+  if (!vip.load(opts.vipInterpreter, opts.vipMonitor, boot)) {
+    return 1;
+  }
+  uint32_t frames =
+      opts.headlessFrames > 0 ? opts.headlessFrames : VIP_COMPARE_FRAMES;
+  Uint64 start = SDL_GetTicksNS();
+  vipComparison r;
+  bool same = vipCompare::run(boot, vip, frames, r);
+  double seconds = (SDL_GetTicksNS() - start) / 1e9;
+
+  logging::flush(); // the report goes after anything logged on the way
+  printf("compared  %llu instructions over %u frames\n",
+         (unsigned long long)r.instructions, r.frames);
+  printf("1802      %llu machine cycles in %.2fs (%.0fx real time)\n",
+         (unsigned long long)r.cycles, seconds,
+         seconds > 0 ? r.frames / 60.0 / seconds : 0.0);
+  // what --vip-timing gives the interpreter each frame, against what it got
+  printf("program   %.0f cycles per frame outside interrupts "
+         "(--vip-timing: %d)\n",
+         r.frames > 0 ? (double)r.programCycles / r.frames : 0.0,
+         VIP_CHIP8_CYCLES);
+  if (same) {
+    printf("matched   until stop: %s\n", r.what);
+    return 0;
+  }
+  printf("diverged  after %04X, at %03X: %s\n", r.opcode, r.pc, r.what);
+  return 1;
+}
+
+int main(int argc, char *argv[]) {
+  options opts;
+  debugger dbg;
+  dbg.init();
+  if (!parseArgs(argc, argv, opts, dbg)) {
+    return 1;
+  }
+  LOG_INFO("display_kernels", "simd",
+           simdName(selectDisplayKernels(opts.simd)));
+
+  if (opts.sweepPath != NULL) {
+    sweepMatrix matrix;
+    if (!loadSweep(opts.sweepPath, quirksFor(opts.profile), matrix)) {
+      return 1;
+    }
+    return runSweep(matrix, opts.workers, IPF, opts.checkpointPath) ? 0 : 1;
+  }
+
+  cpu cpu = BOOT_STATE;
+  cpu.quirks = quirksFor(opts.profile);
+  uint32_t seed = time(0);
+  cpu.seed(seed);
+  if (!cpu.loadRom(opts.romName)) {
+    cpu.running = false;
+    return 1;
+    // error already logged
+  }
+  if (opts.monteCarloSeeds > 0) {
+    return runMonteCarloReport(cpu, opts);
+  }
+  if (opts.vipInterpreter != NULL) {
+    return runVipComparison(cpu, opts);
+  }
+
+  // The state file is keyed by the loaded image, so it only ever resumes
+  // the same ROM. A resumed session takes priority over a boot snapshot.
+  stateFile state;
+  bool restored = false;
+  if (opts.statePath != NULL) {
+    if (!state.open(opts.statePath, romHash(cpu))) {
+      return 1;
+    }
+    restored = state.restore(cpu);
+  }
+  bootSnapshot boot;
+  if (!restored && opts.snapshotDir != NULL) {
+    restored = boot.open(opts.snapshotDir, opts.snapshotAt, seed, cpu);
+  }
+  if (restored) {
+    // saved on the way out: running may be false and keys still held
+    cpu.running = true;
+    memset(cpu.key, 0, sizeof(cpu.key));
+    memset(cpu.prevKeys, 0, sizeof(cpu.prevKeys));
+    cpu.draw = true;
+    // the saved quirks win unless a profile was asked for
+    quirkConfig wanted = quirksFor(opts.profile);
+    if (opts.profileGiven && cpu.quirks != wanted) {
+      LOG_WARN("state_quirks_overridden", "by", "--profile");
+      cpu.quirks = wanted;
+    }
+  }
+  if (opts.headlessFrames > 0) {
+    return runHeadless(cpu, opts, state, boot);
+  }
+
+  timeline travel;
+  if (opts.rewind) {
+    travel.init(IPF);
+  }
+  heatmap heat;
+  heat.init();
+
+  gdbStub stub;
+  if (opts.gdbPort != 0 && !stub.start(opts.gdbPort, cpu, dbg)) {
+    return 1;
+  }
+
+  SDL_Window *window = initWindow();
+  if (window == NULL) {
+    // Handle the error, already logged by createWindow
+    SDL_Quit();
+    return 1;
+  }
+
+  SDL_Renderer *renderer = SDL_CreateRenderer(window, NULL);
+  // Display is streamed at native resolution and scaled up on the GPU
+  SDL_Texture *texture =
+      SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888,
+                        SDL_TEXTUREACCESS_STREAMING, DISPLAY_WIDTH,
+                        DISPLAY_HEIGHT);
+  SDL_SetTextureScaleMode(texture, SDL_SCALEMODE_NEAREST);
+  if (opts.vsync && !SDL_SetRenderVSync(renderer, 1)) {
+    LOG_WARN("vsync_unavailable", "error", SDL_GetError());
+    opts.vsync = false;
+  }
+
+  phosphor phosphor;
+  phosphor.init(opts.phosphor);
+  uint64_t presentedHash = 0; // hash of the frame currently on screen
+  bool presented = false;
+
+  // TODO: audio
+  SDL_AudioSpec audioSpec;
+  audioSpec.format = SDL_AUDIO_S8;
+  audioSpec.channels = 1;
+  audioSpec.freq = 48000;
+
+  SDL_AudioStream *audioStream = SDL_OpenAudioDeviceStream(
+      SDL_AUDIO_DEVICE_DEFAULT_PLAYBACK, &audioSpec, NULL, NULL);
+
+  SDL_ResumeAudioStreamDevice(audioStream);
+  SDL_PutAudioStreamData(audioStream, NULL, 800);
+
+  vipClock clock;
+  clock.init();
+  emulation session =
+      opts.vipTiming ? runSession(cpu, clock) : runSession(cpu, IPF);
+  frameStats stats = {0, 0, 0, 0};
+  int skippedInRow = 0;
+  Uint64 nextFrame = SDL_GetTicksNS();
+  Uint64 lastVblank = nextFrame;     // vsync: when the last present returned
+  Uint64 refreshNs = FRAME_NS;       // vsync: measured refresh period
+  Uint64 workNs = 2 * SDL_NS_PER_MS; // vsync: recent peak poll-to-submit time
+  uint64_t allocBaseline = 0;
+
+  while (cpu.running) {
+    if (opts.vsync) {
+      // Late latch: sleep through most of the refresh so input is polled and
+      // the frame emulated just before the vblank that will show it
+      Uint64 budget = workNs + LATCH_MARGIN_NS;
+      Uint64 latch = lastVblank + (budget < refreshNs ? refreshNs - budget : 0);
+      Uint64 now = SDL_GetTicksNS();
+      if (now < latch) {
+        SDL_DelayNS(latch - now);
       }
+      // displays faster than 60Hz keep showing the previous frame
+      if (nextFrame > lastVblank + refreshNs) {
+        lastVblank += refreshNs;
+        continue;
       }
     }
+    Uint64 workStart = SDL_GetTicksNS();
 
-    for (int i = 0; i < IPF; i++) {
-      cpu.executeCycle();
-      if (cpu.breakIPF) {
+    // while the gdb client holds the cpu its thread may be writing registers
+    // and memory, so the loop leaves keys, rewind and the state file alone
+    bool held = stub.holding();
+    if (held) {
+      if (pollQuit()) {
         break;
       }
+    } else {
+      pollInput(cpu, dbg, !stub.attached(), opts.rewind ? &travel : NULL);
     }
-    if (cpu.draw) { // avoid drawing unless needed
-      SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
-      SDL_RenderClear(renderer);
-      for (int y = 0; y < 32; y++) {
-        for (int x = 0; x < 64; x++) {
-          if (cpu.gfx[x + (y * 64)]) {
-            SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
-            SDL_FRect rect = {static_cast<float>(x * WINDOW_SCALE),
-                              static_cast<float>(y * WINDOW_SCALE),
-                              WINDOW_SCALE, WINDOW_SCALE};
-            SDL_RenderFillRect(renderer, &rect);
-          }
+    bool sound = false;
+    if (!held && !(opts.rewind && travel.isPaused())) {
+      // checkpoints must be frame boundaries; replay runs whole frames
+      if (opts.rewind && !dbg.isStopped() && dbg.atFrameStart()) {
+        travel.record(cpu);
+      }
+      bool wasStopped = dbg.isStopped();
+      if (dbg.active() || stub.attached()) {
+        sound = dbg.runFrame(cpu, IPF);
+      } else if (boot.pending()) {
+        sound = boot.runFrame(cpu, IPF);
+      } else if (opts.heatmapPrefix != NULL) {
+        sound = cpu.runFrame(IPF, heat);
+      } else {
+        session.runFrame();
+        sound = session.sounding();
+      }
+      if (dbg.isStopped() && !wasStopped) {
+        dbg.logState(cpu);
+      }
+    }
+    if (!held) {
+      state.save(cpu);
+    }
+    stats.emulated++;
+    if (stats.emulated == ALLOC_WARMUP_FRAMES) {
+      allocBaseline = alloccount::allocations();
+    }
+    nextFrame += FRAME_NS;
+    if (sound) {
+      // TODO: Audio
+    }
+
+    // Emulation and timers always advance a full frame; when the host is
+    // already late for the next one, rendering is what gets dropped.
+    // Under vsync the present itself paces the loop, so nothing is skipped.
+    Uint64 now = SDL_GetTicksNS();
+    bool behind = !opts.vsync && now > nextFrame;
+    bool didPresent = false;
+    // avoid drawing unless needed; fading phosphor still changes each frame
+    if (cpu.draw || phosphor.active()) {
+      if (behind && skippedInRow < MAX_FRAMESKIP) {
+        stats.skipped++;
+        skippedInRow++;
+      } else {
+        phosphor.compose(cpu.gfx);
+        // sprites drawn and erased within a frame leave the display unchanged
+        uint64_t hash = hashDisplay(phosphor.intensity);
+        if (!presented || hash != presentedHash) {
+          Uint64 work = SDL_GetTicksNS() - workStart;
+          workNs = (work > workNs) ? work : workNs - workNs / 16;
+          renderFrame(renderer, texture, phosphor.intensity);
+          presentedHash = hash;
+          presented = true;
+          didPresent = true;
+          stats.presented++;
         }
+        cpu.draw = false;
+        skippedInRow = 0;
       }
-      SDL_SetRenderTarget(renderer, NULL);
-      SDL_RenderPresent(renderer);
-      cpu.draw = false;
     }
 
-    // Delay by 16ms to have timer decrement at 60hz (roughly)
-    SDL_Delay(16);
-    if (cpu.timers()) {
-      // TODO: Audio
+    now = SDL_GetTicksNS();
+    if (opts.vsync) {
+      if (didPresent) {
+        // present returned at vblank; track the real refresh period
+        Uint64 interval = now - lastVblank;
+        if (interval > refreshNs / 2 && interval < refreshNs * 2) {
+          refreshNs = (refreshNs * 7 + interval) / 8;
+        }
+        lastVblank = now;
+      } else {
+        lastVblank += refreshNs;
+      }
+    } else if (now < nextFrame) {
+      SDL_DelayNS(nextFrame - now);
+    }
+    if (now > nextFrame && now - nextFrame > MAX_LAG_NS) {
+      // host stalled (e.g. window dragged); resync instead of fast-forwarding
+      stats.dropped += (now - nextFrame) / FRAME_NS;
+      nextFrame = now;
+    }
+  }
+
+  LOG_INFO("frames", "emulated", stats.emulated, "presented",
+           stats.presented, "skipped", stats.skipped, "dropped",
+           stats.dropped);
+  bool allocOk = !opts.allocCheck || checkAllocations(stats.emulated,
+                                                      allocBaseline);
+
+  stub.shutdown();
+  if (cpu.badOpcode != 0) {
+    LOG_ERROR("bad_opcode", "opcode", logging::hex(cpu.badOpcode));
+    // resuming would only crash again
+    state.discard();
+  }
+  state.close();
+
+  if (opts.heatmapPrefix != NULL) {
+    std::string prefix = opts.heatmapPrefix;
+    if (!heat.writeImage((prefix + ".ppm").c_str()) ||
+        !heat.writeMap((prefix + ".map").c_str())) {
+      LOG_ERROR("heatmap_write_failed", "prefix", opts.heatmapPrefix);
     }
   }
 
@@ -243,5 +886,5 @@ int main(int argc, char *argv[]) {
   SDL_DestroyWindow(window);
   SDL_Quit();
 
-  return 0;
+  return allocOk ? 0 : 1;
 }
@@ -0,0 +1,386 @@
+#include "memo.h"
+#include <cstring>
+
+namespace {
+
+struct effects {
+  uint16_t reads, writes; // V registers
+  bool readI, writeI;
+  bool returns;
+};
+
+uint16_t regRange(int last) { return (uint16_t)((2u << last) - 1); }
+
+// What an instruction does to V and I, decoded exactly as cpu::step does.
+// Returns false for instructions a memoized call may not contain.
+bool decode(uint16_t op, effects &e) {
+  uint16_t x = 1u << ((op >> 8) & 0xF);
+  uint16_t y = 1u << ((op >> 4) & 0xF);
+  const uint16_t vf = 1u << 0xF;
+  e = {0, 0, false, false, false};
+  switch (op & 0xF000) {
+  case (0x0000):
+    if ((op & 0xF) == 0x0) {
+      return false; // 00E0 touches the display
+    }
+    e.returns = (op & 0xF) == 0xE;
+    return true;
+  case (0x1000):
+    return true;
+  case (0x2000):
+    return false; // nested calls
+  case (0x3000):
+  case (0x4000):
+    e.reads = x;
+    return true;
+  case (0x5000):
+  case (0x9000):
+    e.reads = x | y;
+    return true;
+  case (0x6000):
+    e.writes = x;
+    return true;
+  case (0x7000):
+    e.reads = x;
+    e.writes = x;
+    return true;
+  case (0x8000):
+    switch (op & 0xF) {
+    case (0x0):
+      e.reads = y;
+      e.writes = x;
+      break;
+    case (0x1):
+    case (0x2):
+    case (0x3):
+    case (0x4):
+    case (0x5):
+    case (0x6):
+    case (0x7):
+      e.reads = x | y;
+      e.writes = x | vf;
+      break;
+    case (0xE):
+      e.reads = y;
+      e.writes = x | vf;
+      break;
+    }
+    return true;
+  case (0xA000):
+    e.writeI = true;
+    return true;
+  case (0xB000):
+    e.reads = 1;
+    return true;
+  case (0xC000): // rng
+  case (0xD000): // display and vblank
+    return false;
+  case (0xE000):
+    return (op & 0xFF) != 0x9E && (op & 0xFF) != 0xA1; // keys
+  default: // 0xF000
+    switch (op & 0xFF) {
+    case (0x0A): // keys
+    case (0x07): // timers
+    case (0x15):
+    case (0x18):
+      return false;
+    case (0x1E):
+      e.reads = x;
+      e.readI = e.writeI = true;
+      break;
+    case (0x29):
+      e.reads = x;
+      e.writeI = true;
+      break;
+    case (0x33):
+      e.reads = x;
+      e.readI = true;
+      break;
+    case (0x55):
+      e.reads = regRange((op >> 8) & 0xF);
+      e.readI = e.writeI = true;
+      break;
+    case (0x65):
+      e.writes = regRange((op >> 8) & 0xF);
+      e.readI = e.writeI = true;
+      break;
+    }
+    return true;
+  }
+}
+
+} // namespace
+
+// Hooks for the call being recorded: collects its data reads and writes
+struct memoRecorder {
+  subroutineMemo &m;
+  const cpu &c;
+  bool dirty; // wrote recorded code, this call's or another routine's
+  void onExecute(uint16_t pc) {
+    m.code[pc & 0xFFF] = 1;
+    m.code[(pc + 1) & 0xFFF] = 1;
+  }
+  void onRead(uint16_t addr) {
+    addr &= 0xFFF;
+    subroutineMemo::entry &e = m.pending;
+    for (int i = 0; i < e.writes; i++) {
+      if (e.out[i].addr == addr) {
+        return; // produced by the call itself
+      }
+    }
+    for (int i = 0; i < e.reads; i++) {
+      if (e.in[i].addr == addr) {
+        return;
+      }
+    }
+    if (e.reads == MEMO_MAX_ACCESSES) {
+      m.aborted = true;
+      return;
+    }
+    e.in[e.reads++] = {addr, c.readMemory(addr)};
+  }
+  void onWrite(uint16_t addr) {
+    addr &= 0xFFF;
+    subroutineMemo::entry &e = m.pending;
+    if (m.code[addr]) {
+      m.aborted = true; // self-modifying
+      dirty = true;
+      return;
+    }
+    for (int i = 0; i < e.writes; i++) {
+      if (e.out[i].addr == addr) {
+        return;
+      }
+    }
+    if (e.writes == MEMO_MAX_ACCESSES) {
+      m.aborted = true;
+      return;
+    }
+    e.out[e.writes++].addr = addr; // value taken when the call returns
+  }
+};
+
+void subroutineMemo::init() {
+  routines.clear();
+  routines.reserve(MEMO_MAX_ROUTINES);
+  hitCount = 0;
+  skipped = 0;
+  invalidate();
+}
+
+void subroutineMemo::invalidate() {
+  routines.clear();
+  memset(index, 0xFF, sizeof(index));
+  memset(code, 0, sizeof(code));
+  recording = false;
+}
+
+// The routine for a call target, creating it if there is room; -1 if not
+int subroutineMemo::findRoutine(uint16_t addr) {
+  if (index[addr] >= 0) {
+    return index[addr];
+  }
+  if ((int)routines.size() == MEMO_MAX_ROUTINES) {
+    return -1;
+  }
+  routines.emplace_back();
+  routine &r = routines.back();
+  r.addr = addr;
+  r.impure = false;
+  r.used = 0;
+  r.next = 0;
+  r.shortest = MEMO_MAX_INSTRUCTIONS;
+  r.recorded = 0;
+  r.hits = 0;
+  index[addr] = (int16_t)(routines.size() - 1);
+  return index[addr];
+}
+
+const subroutineMemo::entry *subroutineMemo::match(const routine &r,
+                                                   const cpu &c) const {
+  for (int n = 0; n < r.used; n++) {
+    const entry &e = r.entries[n];
+    if (e.readI && c.I != e.inI) {
+      continue;
+    }
+    bool same = true;
+    for (int i = 0; i < e.inRegs && same; i++) {
+      same = c.V[e.inV[i].reg] == e.inV[i].value;
+    }
+    for (int i = 0; i < e.reads && same; i++) {
+      same = c.memory[e.in[i].addr] == e.in[i].value;
+    }
+    if (same) {
+      return &e;
+    }
+  }
+  return nullptr;
+}
+
+// Leaves c exactly as running the call, body and return would
+void subroutineMemo::apply(const entry &e, cpu &c) {
+  c.stack[c.sp] = c.pc + 2; // pushed by the call, popped by the return
+  c.pc += 2;
+  for (int i = 0; i < e.outRegs; i++) {
+    c.V[e.outV[i].reg] = e.outV[i].value;
+  }
+  if (e.writeI) {
+    c.I = e.outI;
+  }
+  bool dirty = false;
+  for (int i = 0; i < e.writes; i++) {
+    c.memory[e.out[i].addr] = e.out[i].value;
+    dirty |= code[e.out[i].addr] != 0;
+  }
+  c.opcode = e.lastOpcode;
+  c.keyWait = false;
+  c.breakIPF = false;
+  if (dirty) {
+    invalidate();
+  }
+}
+
+void subroutineMemo::beginRecording(int r) {
+  recording = true;
+  pendingRoutine = r;
+  writtenRegs = 0;
+  writtenI = false;
+  aborted = false;
+  pending.readRegs = 0;
+  pending.inRegs = 0;
+  pending.readI = false;
+  pending.reads = 0;
+  pending.writes = 0;
+  pending.instructions = 0;
+}
+
+// Executes the next instruction of the call being recorded; false once
+// recording has stopped
+bool subroutineMemo::recordStep(cpu &c) {
+  uint16_t op = c.readMemory(c.pc) << 8 | c.readMemory(c.pc + 1);
+  effects fx;
+  bool call = pending.instructions == 0;
+  if (call ? (op & 0xF000) != 0x2000 : !decode(op, fx)) {
+    aborted = true;
+  }
+  if (call) {
+    fx = {0, 0, false, false, false};
+  }
+  if (++pending.instructions > MEMO_MAX_INSTRUCTIONS) {
+    aborted = true;
+  }
+  if (aborted) {
+    // run it unrecorded and stop trying this routine
+    routines[pendingRoutine].impure = true;
+    recording = false;
+    memoWatch watch = {code, false};
+    c.step(watch);
+    if (watch.dirty) {
+      invalidate();
+    }
+    return false;
+  }
+
+  uint16_t inputs = fx.reads & ~writtenRegs;
+  for (int i = 0; i < 16; i++) {
+    if (inputs >> i & 1 && !(pending.readRegs >> i & 1)) {
+      pending.inV[pending.inRegs++] = {(uint8_t)i, c.V[i]};
+    }
+  }
+  pending.readRegs |= inputs;
+  if (fx.readI && !writtenI && !pending.readI) {
+    pending.readI = true;
+    pending.inI = c.I;
+  }
+  writtenRegs |= fx.writes;
+  writtenI |= fx.writeI;
+
+  memoRecorder rec = {*this, c, false};
+  c.step(rec);
+  if (rec.dirty) {
+    // entries recorded over the old code no longer hold
+    invalidate();
+    return false;
+  }
+  if (aborted) {
+    // the instruction has run; only the recording is abandoned
+    routines[pendingRoutine].impure = true;
+    recording = false;
+    return false;
+  }
+  if (fx.returns) {
+    finishRecording(c);
+    return false;
+  }
+  return true;
+}
+
+void subroutineMemo::finishRecording(const cpu &c) {
+  recording = false;
+  routine &r = routines[pendingRoutine];
+  entry &e = pending;
+  e.writeI = writtenI;
+  e.outRegs = 0;
+  for (int i = 0; i < 16; i++) {
+    if (writtenRegs >> i & 1) {
+      e.outV[e.outRegs++] = {(uint8_t)i, c.V[i]};
+    }
+  }
+  e.outI = c.I;
+  for (int i = 0; i < e.writes; i++) {
+    if (code[e.out[i].addr]) {
+      // wrote code it went on to run; other routines may share those bytes
+      invalidate();
+      return;
+    }
+    e.out[i].value = c.memory[e.out[i].addr];
+  }
+  e.lastOpcode = c.opcode;
+  r.entries[r.next] = e;
+  if (e.instructions < r.shortest) {
+    r.shortest = e.instructions;
+  }
+  r.next = (r.next + 1) % MEMO_ENTRIES;
+  if (r.used < MEMO_ENTRIES) {
+    r.used++;
+  }
+  // inputs that rarely repeat cost a recording per call for nothing
+  r.recorded++;
+  if (r.recorded >= 4 * MEMO_ENTRIES && r.hits < r.recorded) {
+    r.impure = true;
+  }
+}
+
+// step() for a 2NNN call or an instruction of a call being recorded
+int subroutineMemo::callStep(cpu &c, int budget) {
+  if (recording) {
+    recordStep(c);
+    return 1;
+  }
+  uint16_t op = c.readMemory(c.pc) << 8 | c.readMemory(c.pc + 1);
+  int r = findRoutine(op & 0x0FFF);
+  // with no budget for any remembered call, it runs as usual
+  if (r >= 0 && !routines[r].impure &&
+      (routines[r].used == 0 || routines[r].shortest <= budget)) {
+    const entry *e = match(routines[r], c);
+    if (e == nullptr) {
+      beginRecording(r);
+      recordStep(c);
+      return 1;
+    }
+    if (e->instructions <= budget) {
+      int n = e->instructions;
+      routines[r].hits++;
+      hitCount++;
+      skipped += n;
+      apply(*e, c);
+      return n;
+    }
+  }
+  memoWatch watch = {code, false};
+  c.step(watch);
+  if (watch.dirty) {
+    invalidate();
+  }
+  return 1;
+}
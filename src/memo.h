@@ -0,0 +1,108 @@
+#pragma once
+#include "cpu.h"
+#include <cstdint>
+#include <vector>
+
+const int MEMO_MAX_ROUTINES = 64;
+const int MEMO_ENTRIES = 8;          // remembered input sets per routine
+const int MEMO_MAX_ACCESSES = 32;    // data reads or writes per call
+const int MEMO_MAX_INSTRUCTIONS = 256;
+
+// Hooks for ordinary instructions: notices writes to recorded code
+struct memoWatch {
+  const uint8_t *code;
+  bool dirty;
+  void onExecute(uint16_t) {}
+  void onRead(uint16_t) {}
+  void onWrite(uint16_t addr) { dirty |= code[addr & 0xFFF] != 0; }
+};
+
+// Memoizes pure 2NNN subroutines. A call is recorded the first time it
+// runs: which registers, I and memory bytes it reads before writing them
+// (its inputs), and what it leaves in the registers, I and memory it
+// writes. A later call with the same inputs applies those results instead
+// of executing the body.
+//
+// Only calls that touch nothing but V, I and memory qualify: a body using
+// the display, keys, timers, CXNN or a nested call is never memoized.
+// Writes to a recorded routine's code drop the whole table. A hit is only
+// taken when the call, body and return all fit in the frame's remaining
+// instruction budget, so the result is exactly what executeCycle would
+// have produced, frame by frame.
+//
+// Memory changed from outside cpu::step (loading a ROM, restoring state,
+// the debugger) must be followed by reset().
+class subroutineMemo {
+private:
+  struct access {
+    uint16_t addr;
+    uint8_t value;
+  };
+  struct regValue {
+    uint8_t reg, value;
+  };
+  struct entry {
+    uint16_t readRegs; // inputs, as a mask
+    bool readI, writeI;
+    uint8_t inRegs, outRegs, reads, writes;
+    regValue inV[16];
+    uint16_t inI;
+    access in[MEMO_MAX_ACCESSES];
+    regValue outV[16];
+    uint16_t outI;
+    access out[MEMO_MAX_ACCESSES];
+    uint16_t lastOpcode;
+    uint16_t instructions; // including the call and the return
+  };
+  struct routine {
+    uint16_t addr;
+    bool impure; // uses something memoization can't capture
+    int used;    // valid entries
+    int next;    // entry to replace next
+    int shortest; // fewest instructions of any entry
+    uint32_t recorded, hits;
+    entry entries[MEMO_ENTRIES];
+  };
+
+  std::vector<routine> routines;
+  int16_t index[4096];  // routine for each call target, -1 = none
+  uint8_t code[4096];   // bytes fetched by recorded calls
+  bool recording;
+  entry pending;        // the call being recorded
+  int pendingRoutine;
+  uint16_t writtenRegs; // registers written so far by the pending call
+  bool writtenI;
+  bool aborted;
+  uint64_t hitCount, skipped;
+
+  friend struct memoRecorder;
+
+  int findRoutine(uint16_t addr);
+  const entry *match(const routine &r, const cpu &c) const;
+  void apply(const entry &e, cpu &c);
+  void beginRecording(int r);
+  bool recordStep(cpu &c);
+  void finishRecording(const cpu &c);
+  void invalidate();
+  int callStep(cpu &c, int budget);
+
+public:
+  void init();
+  void reset() { invalidate(); }
+  // Runs one instruction, or a whole memoized call if it fits in budget
+  // (> 0). Returns the number of instructions accounted for.
+  int step(cpu &c, int budget) {
+    if (!recording && (c.readMemory(c.getPC()) & 0xF0) != 0x20) {
+      memoWatch watch = {code, false};
+      c.step(watch);
+      if (watch.dirty) {
+        invalidate();
+      }
+      return 1;
+    }
+    return callStep(c, budget);
+  }
+  uint64_t hits() const { return hitCount; }
+  uint64_t instructionsSkipped() const { return skipped; }
+  int routineCount() const { return (int)routines.size(); }
+};
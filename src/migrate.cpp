@@ -0,0 +1,307 @@
+#include "migrate.h"
+#include <cstring>
+
+const uint8_t RUN_MAGIC[3] = {'C', '8', 'R'};
+const uint8_t RUN_VERSION = 1;
+
+enum runTag {
+  TAG_SEED = 1,     // varint
+  TAG_FRAME = 2,    // varint
+  TAG_WAITING = 3,  // varint
+  TAG_CURSOR = 4,   // varint, input script position
+  TAG_FINISHED = 5, // varint 0/1
+  TAG_REGS = 6,     // V0-VF, I, pc, sp, delay, sound, opcode
+  TAG_STACK = 7,    // 16 little endian words
+  TAG_RNG = 8,      // 4 bytes
+  TAG_BADOP = 9,    // 2 bytes
+  TAG_KEYS = 10,    // key mask, previous key mask: 2 bytes each
+  TAG_MEMORY = 11,  // (skip varint, count varint, count bytes)* XOR boot
+  TAG_DISPLAY = 12, // 2048 pixels, one bit each
+  TAG_FLAGS = 13,   // cpu flag bits, see FLAG_*
+};
+
+enum cpuFlag {
+  FLAG_RUNNING = 1 << 1,
+  FLAG_DRAW = 1 << 2,
+  FLAG_KEY_WAIT = 1 << 3,
+  FLAG_BREAK_IPF = 1 << 4,
+  FLAG_VBLANK_WAIT = 1 << 5,
+  FLAG_VBLANK_INTERRUPT = 1 << 6,
+  FLAG_DISPLAY_WAIT = 1 << 7,
+};
+
+namespace {
+
+void putVarint(std::vector<uint8_t> &out, uint64_t v) {
+  while (v >= 0x80) {
+    out.push_back((uint8_t)(v | 0x80));
+    v >>= 7;
+  }
+  out.push_back((uint8_t)v);
+}
+
+bool getVarint(const uint8_t *&p, const uint8_t *end, uint64_t &v) {
+  v = 0;
+  for (int shift = 0; shift < 64 && p < end; shift += 7) {
+    uint8_t b = *p++;
+    v |= (uint64_t)(b & 0x7F) << shift;
+    if (!(b & 0x80)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void putRecord(std::vector<uint8_t> &out, int tag, const uint8_t *data,
+               size_t len) {
+  out.push_back((uint8_t)tag);
+  putVarint(out, len);
+  out.insert(out.end(), data, data + len);
+}
+
+void putVarintRecord(std::vector<uint8_t> &out, int tag, uint64_t v) {
+  std::vector<uint8_t> payload;
+  putVarint(payload, v);
+  putRecord(out, tag, payload.data(), payload.size());
+}
+
+void putWord(uint8_t *p, uint16_t v) {
+  p[0] = v & 0xFF;
+  p[1] = v >> 8;
+}
+
+uint16_t getWord(const uint8_t *p) { return p[0] | p[1] << 8; }
+
+bool readVarintPayload(const uint8_t *p, size_t len, uint32_t &v) {
+  uint64_t value;
+  const uint8_t *end = p + len;
+  if (!getVarint(p, end, value) || p != end || value > UINT32_MAX) {
+    return false;
+  }
+  v = value;
+  return true;
+}
+
+} // namespace
+
+void stateCodec::encode(const cpu &c, const cpu &boot,
+                        std::vector<uint8_t> &out) {
+  uint8_t regs[16 + 2 + 2 + 1 + 1 + 1 + 2];
+  memcpy(regs, c.V, 16);
+  putWord(regs + 16, c.I);
+  putWord(regs + 18, c.pc);
+  regs[20] = c.sp;
+  regs[21] = c.delay_timer;
+  regs[22] = c.sound_timer;
+  putWord(regs + 23, c.opcode);
+  putRecord(out, TAG_REGS, regs, sizeof(regs));
+
+  uint8_t stack[32];
+  for (int i = 0; i < 16; i++) {
+    putWord(stack + 2 * i, c.stack[i]);
+  }
+  putRecord(out, TAG_STACK, stack, sizeof(stack));
+
+  uint8_t rng[4] = {(uint8_t)c.rng, (uint8_t)(c.rng >> 8),
+                    (uint8_t)(c.rng >> 16), (uint8_t)(c.rng >> 24)};
+  putRecord(out, TAG_RNG, rng, sizeof(rng));
+
+  if (c.badOpcode != 0) {
+    uint8_t bad[2];
+    putWord(bad, c.badOpcode);
+    putRecord(out, TAG_BADOP, bad, sizeof(bad));
+  }
+
+  uint16_t keys = 0, prev = 0;
+  for (int i = 0; i < 16; i++) {
+    keys |= (c.key[i] != 0) << i;
+    prev |= (c.prevKeys[i] != 0) << i;
+  }
+  uint8_t keyBytes[4];
+  putWord(keyBytes, keys);
+  putWord(keyBytes + 2, prev);
+  putRecord(out, TAG_KEYS, keyBytes, sizeof(keyBytes));
+
+  // runs of bytes that differ from the boot image
+  std::vector<uint8_t> mem;
+  int addr = 0;
+  while (addr < 4096) {
+    int start = addr;
+    while (addr < 4096 && c.memory[addr] == boot.memory[addr]) {
+      addr++;
+    }
+    if (addr == 4096) {
+      break;
+    }
+    int skip = addr - start;
+    int first = addr;
+    while (addr < 4096 && c.memory[addr] != boot.memory[addr]) {
+      addr++;
+    }
+    putVarint(mem, skip);
+    putVarint(mem, addr - first);
+    for (int i = first; i < addr; i++) {
+      mem.push_back(c.memory[i] ^ boot.memory[i]);
+    }
+  }
+  putRecord(out, TAG_MEMORY, mem.data(), mem.size());
+
+  uint8_t display[64 * 32 / 8] = {};
+  for (int i = 0; i < 64 * 32; i++) {
+    display[i / 8] |= (c.gfx[i] != 0) << (i % 8);
+  }
+  putRecord(out, TAG_DISPLAY, display, sizeof(display));
+
+  uint8_t flags = (c.running ? FLAG_RUNNING : 0) | (c.draw ? FLAG_DRAW : 0) |
+                  (c.keyWait ? FLAG_KEY_WAIT : 0) |
+                  (c.breakIPF ? FLAG_BREAK_IPF : 0) |
+                  (c.vblankWait ? FLAG_VBLANK_WAIT : 0) |
+                  (c.vblankInterrupt ? FLAG_VBLANK_INTERRUPT : 0) |
+                  (c.quirks.displayWait ? FLAG_DISPLAY_WAIT : 0);
+  putRecord(out, TAG_FLAGS, &flags, 1);
+}
+
+bool stateCodec::decode(int tag, const uint8_t *p, size_t len, const cpu &boot,
+                        cpu &c) {
+  switch (tag) {
+  case (TAG_REGS):
+    if (len != 25) {
+      return false;
+    }
+    memcpy(c.V, p, 16);
+    c.I = getWord(p + 16);
+    c.pc = getWord(p + 18);
+    c.sp = p[20] & 0xF;
+    c.delay_timer = p[21];
+    c.sound_timer = p[22];
+    c.opcode = getWord(p + 23);
+    return true;
+  case (TAG_STACK):
+    if (len != 32) {
+      return false;
+    }
+    for (int i = 0; i < 16; i++) {
+      c.stack[i] = getWord(p + 2 * i);
+    }
+    return true;
+  case (TAG_RNG):
+    if (len != 4) {
+      return false;
+    }
+    c.rng = p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+    return true;
+  case (TAG_BADOP):
+    if (len != 2) {
+      return false;
+    }
+    c.badOpcode = getWord(p);
+    return true;
+  case (TAG_KEYS): {
+    if (len != 4) {
+      return false;
+    }
+    uint16_t keys = getWord(p), prev = getWord(p + 2);
+    for (int i = 0; i < 16; i++) {
+      c.key[i] = (keys >> i) & 1;
+      c.prevKeys[i] = (prev >> i) & 1;
+    }
+    return true;
+  }
+  case (TAG_MEMORY): {
+    memcpy(c.memory, boot.memory, sizeof(c.memory));
+    const uint8_t *end = p + len;
+    uint64_t addr = 0;
+    while (p < end) {
+      uint64_t skip, count;
+      if (!getVarint(p, end, skip) || !getVarint(p, end, count) ||
+          addr + skip + count > 4096 || (uint64_t)(end - p) < count) {
+        return false;
+      }
+      addr += skip;
+      for (uint64_t i = 0; i < count; i++, addr++) {
+        c.memory[addr] ^= *p++;
+      }
+    }
+    return true;
+  }
+  case (TAG_FLAGS):
+    if (len != 1) {
+      return false;
+    }
+    c.running = p[0] & FLAG_RUNNING;
+    c.draw = p[0] & FLAG_DRAW;
+    c.keyWait = p[0] & FLAG_KEY_WAIT;
+    c.breakIPF = p[0] & FLAG_BREAK_IPF;
+    c.vblankWait = p[0] & FLAG_VBLANK_WAIT;
+    c.vblankInterrupt = p[0] & FLAG_VBLANK_INTERRUPT;
+    c.quirks.displayWait = p[0] & FLAG_DISPLAY_WAIT;
+    return true;
+  case (TAG_DISPLAY):
+    if (len != 64 * 32 / 8) {
+      return false;
+    }
+    for (int i = 0; i < 64 * 32; i++) {
+      c.gfx[i] = (p[i / 8] >> (i % 8)) & 1;
+    }
+    return true;
+  default:
+    return true;
+  }
+}
+
+std::vector<uint8_t> encodeRun(const seedRun &run, const cpu &boot) {
+  std::vector<uint8_t> out(RUN_MAGIC, RUN_MAGIC + 3);
+  out.push_back(RUN_VERSION);
+  putVarintRecord(out, TAG_SEED, run.seed);
+  putVarintRecord(out, TAG_FRAME, run.frame);
+  putVarintRecord(out, TAG_WAITING, run.waiting);
+  putVarintRecord(out, TAG_CURSOR, run.next);
+  putVarintRecord(out, TAG_FINISHED, run.finished);
+  stateCodec::encode(run.c, boot, out);
+  return out;
+}
+
+bool decodeRun(const uint8_t *data, size_t size, const cpu &boot,
+               seedRun &run) {
+  if (size < 4 || memcmp(data, RUN_MAGIC, 3) != 0 || data[3] != RUN_VERSION) {
+    return false;
+  }
+  run.start(boot, 0);
+  const uint8_t *p = data + 4;
+  const uint8_t *end = data + size;
+  while (p < end) {
+    int tag = *p++;
+    uint64_t len;
+    if (!getVarint(p, end, len) || (uint64_t)(end - p) < len) {
+      return false;
+    }
+    uint32_t v = 0;
+    bool ok = true;
+    switch (tag) {
+    case (TAG_SEED):
+      ok = readVarintPayload(p, len, run.seed);
+      break;
+    case (TAG_FRAME):
+      ok = readVarintPayload(p, len, run.frame);
+      break;
+    case (TAG_WAITING):
+      ok = readVarintPayload(p, len, run.waiting);
+      break;
+    case (TAG_CURSOR):
+      ok = readVarintPayload(p, len, run.next);
+      break;
+    case (TAG_FINISHED):
+      ok = readVarintPayload(p, len, v);
+      run.finished = v != 0;
+      break;
+    default:
+      ok = stateCodec::decode(tag, p, len, boot, run.c);
+      break;
+    }
+    if (!ok) {
+      return false;
+    }
+    p += len;
+  }
+  return true;
+}
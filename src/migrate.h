@@ -0,0 +1,30 @@
+#pragma once
+#include "cpu.h"
+#include "montecarlo.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Compact, self-describing encoding of a paused seedRun, used to hand a
+// run to another process. After a 4 byte header ("C8R" + version) the
+// state is a list of records: tag byte, varint length, payload. Decoders
+// skip tags they don't know, so fields can be added without breaking old
+// readers. Memory is stored as the XOR against the ROM's boot image,
+// run-length coded, and the display as a bitmap. A typical run comes to a
+// few hundred bytes rather than sizeof(cpu).
+//
+// Both ends must have the same boot image (the sweep matrix guarantees
+// this).
+std::vector<uint8_t> encodeRun(const seedRun &run, const cpu &boot);
+bool decodeRun(const uint8_t *data, size_t size, const cpu &boot,
+               seedRun &run);
+
+// Reads and writes the cpu's private state for encodeRun/decodeRun
+class stateCodec {
+public:
+  static void encode(const cpu &c, const cpu &boot, std::vector<uint8_t> &out);
+  // Applies one record to c; false if the payload is malformed. Unknown
+  // tags are accepted and ignored.
+  static bool decode(int tag, const uint8_t *p, size_t len, const cpu &boot,
+                     cpu &c);
+};
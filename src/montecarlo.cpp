@@ -0,0 +1,247 @@
+#include "montecarlo.h"
+#include "log.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <thread>
+
+const uint32_t FINISH_WAIT_FRAMES = 60;
+
+bool inputScript::load(const char *path) {
+  FILE *file = fopen(path, "r");
+  if (file == NULL) {
+    LOG_ERROR("script_open_failed", "path", path);
+    return false;
+  }
+  events.clear();
+  char line[256];
+  int lineNo = 0;
+  bool ok = true;
+  while (fgets(line, sizeof(line), file) != NULL) {
+    lineNo++;
+    char *p = line;
+    while (*p == ' ' || *p == '\t') {
+      p++;
+    }
+    if (*p == '#' || *p == '\n' || *p == '\r' || *p == '\0') {
+      continue;
+    }
+    unsigned long frame;
+    unsigned key;
+    char action[8];
+    if (sscanf(p, "%lu %x %7s", &frame, &key, action) != 3 || key > 0xF ||
+        (strcmp(action, "down") != 0 && strcmp(action, "up") != 0)) {
+      LOG_ERROR("script_bad_line", "path", path, "line", lineNo);
+      ok = false;
+      break;
+    }
+    keyEvent e;
+    e.frame = frame;
+    e.key = key;
+    e.down = strcmp(action, "down") == 0;
+    events.push_back(e);
+  }
+  fclose(file);
+  std::stable_sort(events.begin(), events.end(),
+                   [](const keyEvent &a, const keyEvent &b) {
+                     return a.frame < b.frame;
+                   });
+  return ok;
+}
+
+void inputScript::apply(cpu &c, uint32_t frame, uint32_t &next) const {
+  while (next < events.size() && events[next].frame <= frame) {
+    c.key[events[next].key] = events[next].down;
+    next++;
+  }
+}
+
+uint32_t inputScript::lastFrame() const {
+  return events.empty() ? 0 : events.back().frame;
+}
+
+uint64_t inputScript::hash() const {
+  uint64_t hash = 0xCBF29CE484222325ull; // FNV-1a
+  for (size_t i = 0; i < events.size(); i++) {
+    uint64_t e = (uint64_t)events[i].frame << 8 | events[i].key << 1 |
+                 events[i].down;
+    hash = (hash ^ e) * 0x100000001B3ull;
+  }
+  return hash;
+}
+
+bool parseScoreLocation(const char *spec, scoreLocation &score) {
+  char *end;
+  long addr = strtol(spec, &end, 0);
+  if (end == spec || addr < 0 || addr > 0xFFF) {
+    return false;
+  }
+  score.bcd = false;
+  if (strcmp(end, ":bcd") == 0) {
+    score.bcd = true;
+  } else if (*end != '\0') {
+    return false;
+  }
+  score.enabled = true;
+  score.addr = addr;
+  return true;
+}
+
+namespace {
+
+uint32_t readScore(const cpu &c, const scoreLocation &score) {
+  if (!score.bcd) {
+    return c.readMemory(score.addr);
+  }
+  uint32_t value = 0;
+  for (int i = 0; i < 3; i++) {
+    value = value * 10 + c.readMemory(score.addr + i) % 10;
+  }
+  return value;
+}
+
+uint32_t percentile(const uint32_t *histogram, uint64_t runs, double p) {
+  uint64_t target = (uint64_t)std::ceil(runs * p);
+  uint64_t seen = 0;
+  for (uint32_t i = 0; i < SCORE_BUCKETS; i++) {
+    seen += histogram[i];
+    if (seen >= target && seen > 0) {
+      return i;
+    }
+  }
+  return 0;
+}
+
+} // namespace
+
+void seedRun::start(const cpu &boot, uint32_t runSeed) {
+  c = boot;
+  c.seed(runSeed);
+  seed = runSeed;
+  frame = 0;
+  waiting = 0;
+  next = 0;
+  finished = false;
+}
+
+bool seedRun::step(const inputScript &script,
+                   const monteCarloConfig &config, irRunner *ir) {
+  if (frame >= config.frames || !c.running || finished) {
+    return false;
+  }
+  for (int i = 0; i < 16; i++) {
+    c.prevKeys[i] = c.key[i];
+  }
+  script.apply(c, frame, next);
+  if (ir != nullptr) {
+    ir->runFrame(c, config.ipf);
+  } else {
+    c.runFrame(config.ipf);
+  }
+  frame++;
+  waiting = c.keyWait ? waiting + 1 : 0;
+  if (waiting >= FINISH_WAIT_FRAMES && frame > script.lastFrame()) {
+    finished = true; // waiting for a key nobody will press
+  }
+  return frame < config.frames && c.running && !finished;
+}
+
+void seedRun::record(const monteCarloConfig &config,
+                     monteCarloTotals &acc) const {
+  acc.runs++;
+  acc.crashes += c.badOpcode != 0;
+  acc.finished += finished;
+  acc.framesTotal += frame;
+  acc.framesMin = std::min(acc.framesMin, frame);
+  acc.framesMax = std::max(acc.framesMax, frame);
+  if (config.score.enabled) {
+    uint32_t score = readScore(c, config.score);
+    acc.scoreSum += score;
+    acc.scoreSquares += (double)score * score;
+    acc.histogram[score]++;
+  }
+}
+
+void monteCarloTotals::merge(const monteCarloTotals &other) {
+  runs += other.runs;
+  crashes += other.crashes;
+  finished += other.finished;
+  framesTotal += other.framesTotal;
+  framesMin = std::min(framesMin, other.framesMin);
+  framesMax = std::max(framesMax, other.framesMax);
+  scoreSum += other.scoreSum;
+  scoreSquares += other.scoreSquares;
+  for (uint32_t i = 0; i < SCORE_BUCKETS; i++) {
+    histogram[i] += other.histogram[i];
+  }
+}
+
+monteCarloTotals runMonteCarlo(const cpu &boot, const inputScript &script,
+                               const monteCarloConfig &config) {
+  int threads = config.threads;
+  if (threads <= 0) {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  std::vector<monteCarloTotals> accs(threads);
+  std::atomic<uint32_t> claimed(0);
+  // one copy of the compiled code for every thread and seed
+  const irProgram *program =
+      config.ir ? irProgram::shared(boot, config.ipf) : nullptr;
+  std::vector<std::thread> workers;
+  for (int t = 0; t < threads; t++) {
+    workers.emplace_back([&, t] {
+      std::unique_ptr<irRunner> ir;
+      if (program != nullptr) {
+        ir.reset(new irRunner);
+        ir->init(config.ipf);
+      }
+      uint32_t i;
+      while ((i = claimed.fetch_add(1, std::memory_order_relaxed)) <
+             config.seeds) {
+        seedRun run;
+        run.start(boot, config.firstSeed + i);
+        if (ir) {
+          ir->attach(program, run.c);
+        }
+        while (run.step(script, config, ir.get())) {
+        }
+        run.record(config, accs[t]);
+      }
+    });
+  }
+  for (size_t t = 0; t < workers.size(); t++) {
+    workers[t].join();
+  }
+
+  monteCarloTotals total;
+  for (size_t t = 0; t < accs.size(); t++) {
+    total.merge(accs[t]);
+  }
+  return total;
+}
+
+monteCarloResult summarize(const monteCarloTotals &total, bool score) {
+  monteCarloResult r = {};
+  r.runs = total.runs;
+  r.crashes = total.crashes;
+  r.finished = total.finished;
+  r.framesTotal = total.framesTotal;
+  r.framesMin = total.runs ? total.framesMin : 0;
+  r.framesMax = total.framesMax;
+  if (score && total.runs > 0) {
+    r.scoreMean = total.scoreSum / total.runs;
+    double variance =
+        total.scoreSquares / total.runs - r.scoreMean * r.scoreMean;
+    r.scoreStddev = std::sqrt(std::max(0.0, variance));
+    r.scoreMin = percentile(total.histogram, total.runs, 0);
+    r.scoreMax = percentile(total.histogram, total.runs, 1);
+    r.scoreP10 = percentile(total.histogram, total.runs, 0.1);
+    r.scoreP50 = percentile(total.histogram, total.runs, 0.5);
+    r.scoreP90 = percentile(total.histogram, total.runs, 0.9);
+  }
+  return r;
+}
@@ -0,0 +1,107 @@
+#pragma once
+#include "cpu.h"
+#include "irrun.h"
+#include <cstdint>
+#include <vector>
+
+// Scripted key presses for unattended runs. One event per line:
+//   FRAME KEY down|up      e.g. "120 5 down"; KEY is a hex digit
+// Blank lines and lines starting with '#' are ignored.
+struct keyEvent {
+  uint32_t frame;
+  uint8_t key;
+  bool down;
+};
+
+class inputScript {
+private:
+  std::vector<keyEvent> events; // sorted by frame
+
+public:
+  bool load(const char *path);
+  // Applies the events for a frame; next is the caller's cursor, starting 0
+  void apply(cpu &c, uint32_t frame, uint32_t &next) const;
+  // Frame of the last event, 0 for an empty script
+  uint32_t lastFrame() const;
+  // Identifies the script's contents, e.g. in checkpoints
+  uint64_t hash() const;
+};
+
+// Where a game keeps its score: one byte, or three BCD digits as written
+// by FX33 (hundreds first)
+struct scoreLocation {
+  bool enabled;
+  uint16_t addr;
+  bool bcd;
+};
+
+// Parses "ADDR" or "ADDR:bcd"
+bool parseScoreLocation(const char *spec, scoreLocation &score);
+
+struct monteCarloConfig {
+  uint32_t firstSeed;
+  uint32_t seeds;
+  uint32_t frames;   // per run, unless the game ends first
+  int ipf;
+  int threads;       // 0 = one per hardware thread
+  scoreLocation score;
+  bool ir;           // run through IR blocks shared by all the threads
+};
+
+const uint32_t SCORE_BUCKETS = 1000; // covers a byte and 3 BCD digits
+
+struct monteCarloTotals;
+
+// One seed's run, advanced a frame at a time. Between frames it holds
+// everything needed to continue, so a run can be paused and carried to
+// another process (see migrate.h).
+struct seedRun {
+  cpu c;
+  uint32_t seed;
+  uint32_t frame;   // frames run so far
+  uint32_t waiting; // consecutive frames ending in FX0A
+  uint32_t next;    // input script cursor
+  bool finished;    // ended waiting for a key after the script ran out
+
+  void start(const cpu &boot, uint32_t runSeed);
+  // Runs one frame, through ir if given; false once the run is over
+  bool step(const inputScript &script, const monteCarloConfig &config,
+            irRunner *ir = nullptr);
+  void record(const monteCarloConfig &config, monteCarloTotals &acc) const;
+};
+
+// Raw per-run sums. Plain data, so totals from other threads or processes
+// can be merged before they are summarized.
+struct alignas(64) monteCarloTotals {
+  uint64_t runs = 0;
+  uint64_t crashes = 0;
+  uint64_t finished = 0;
+  uint64_t framesTotal = 0;
+  uint32_t framesMin = UINT32_MAX;
+  uint32_t framesMax = 0;
+  double scoreSum = 0;
+  double scoreSquares = 0;
+  uint32_t histogram[SCORE_BUCKETS] = {};
+
+  void merge(const monteCarloTotals &other);
+};
+
+// Aggregated outcome of all runs
+struct monteCarloResult {
+  uint64_t runs;
+  uint64_t crashes;  // stopped on an unknown opcode
+  uint64_t finished; // waiting on FX0A for a second after the script ended
+  uint64_t framesTotal;
+  uint32_t framesMin, framesMax;
+  double scoreMean, scoreStddev;
+  uint32_t scoreMin, scoreMax;
+  uint32_t scoreP10, scoreP50, scoreP90;
+};
+
+// Runs boot (a loaded, unstarted cpu) once per seed with the same input
+// script, spread across threads. Each thread claims seeds from a shared
+// atomic counter and accumulates into its own cache-line aligned totals;
+// the totals are merged once the threads are joined.
+monteCarloTotals runMonteCarlo(const cpu &boot, const inputScript &script,
+                               const monteCarloConfig &config);
+monteCarloResult summarize(const monteCarloTotals &totals, bool score);
@@ -0,0 +1,117 @@
+#include "snapshot.h"
+#include "log.h"
+#include "statefile.h"
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+namespace {
+// Hook policy that notes when an address is executed
+struct pcWatch {
+  uint16_t target;
+  bool hit;
+  void onExecute(uint16_t addr) { hit |= (addr == target); }
+  void onRead(uint16_t) {}
+  void onWrite(uint16_t) {}
+};
+} // namespace
+
+bool parseSnapshotTrigger(const char *spec, snapshotTrigger &trigger) {
+  const char *digits;
+  int base;
+  if (strncmp(spec, "frame:", 6) == 0) {
+    trigger.kind = snapshotTrigger::AT_FRAME;
+    digits = spec + 6;
+    base = 10;
+  } else if (strncmp(spec, "pc:", 3) == 0) {
+    trigger.kind = snapshotTrigger::AT_PC;
+    digits = spec + 3;
+    base = 16;
+  } else {
+    return false;
+  }
+  char *end;
+  unsigned long value = strtoul(digits, &end, base);
+  if (end == digits || *end != '\0') {
+    return false;
+  }
+  if (trigger.kind == snapshotTrigger::AT_PC ? value > 0xFFF : value == 0) {
+    return false;
+  }
+  trigger.value = value;
+  return true;
+}
+
+bool bootSnapshot::open(const char *dir, const snapshotTrigger &when,
+                        uint32_t seed, cpu &c) {
+  // quirks change how the intro runs, so they are part of the key
+  rom = romHash(c);
+  const unsigned char *q = (const unsigned char *)&c.quirks;
+  for (size_t i = 0; i < sizeof(c.quirks); i++) {
+    rom = (rom ^ q[i]) * 0x100000001B3ull;
+  }
+  char name[64];
+  if (when.kind == snapshotTrigger::AT_FRAME) {
+    snprintf(name, sizeof(name), "/%016llx-frame%u.snap",
+             (unsigned long long)rom, (unsigned)when.value);
+  } else {
+    snprintf(name, sizeof(name), "/%016llx-pc%03X.snap",
+             (unsigned long long)rom, (unsigned)when.value);
+  }
+  path = std::string(dir) + name;
+  trigger = when;
+  frames = 0;
+  armed = false;
+
+  // read only: a lookup must never reset an entry another run relies on
+  if (stateFile::load(path.c_str(), rom, c)) {
+    c.seed(seed);
+    LOG_INFO("snapshot_restored", "path", path.c_str());
+    return true;
+  }
+  armed = true;
+  return false;
+}
+
+bool bootSnapshot::runFrame(cpu &c, int ipf) {
+  for (int i = 0; i < 16; i++) {
+    if (c.key[i]) {
+      armed = false; // the intro now depends on this run's input
+      LOG_INFO("snapshot_skipped", "path", path.c_str(), "reason", "input");
+      return c.runFrame(ipf);
+    }
+  }
+  pcWatch watch = {(uint16_t)trigger.value, false};
+  bool sound = c.runFrame(ipf, watch);
+  frames++;
+  if (trigger.kind == snapshotTrigger::AT_FRAME ? frames == trigger.value
+                                                 : watch.hit) {
+    take(c);
+  }
+  return sound;
+}
+
+// Written under a temporary name and renamed into place, so concurrent runs
+// of the same ROM never see a half-written snapshot
+void bootSnapshot::take(const cpu &c) {
+  armed = false;
+  if (!c.running) {
+    return;
+  }
+  std::string tmp = path + "." + std::to_string(getpid());
+  stateFile file;
+  if (!file.open(tmp.c_str(), rom)) {
+    return;
+  }
+  file.save(c);
+  file.close();
+  if (rename(tmp.c_str(), path.c_str()) != 0) {
+    LOG_ERROR("snapshot_write_failed", "path", path.c_str());
+    unlink(tmp.c_str());
+    return;
+  }
+  LOG_INFO("snapshot_taken", "path", path.c_str(), "frame", frames,
+           "pc", logging::hex(c.getPC()));
+}
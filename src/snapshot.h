@@ -0,0 +1,46 @@
+#pragma once
+#include "cpu.h"
+#include <cstdint>
+#include <string>
+
+// When a boot snapshot is taken: after a number of frames, or at the end of
+// the frame in which the program first executes an address
+struct snapshotTrigger {
+  enum { AT_FRAME, AT_PC } kind;
+  uint32_t value;
+};
+
+// Parses "frame:N" or "pc:ADDR" (hex)
+bool parseSnapshotTrigger(const char *spec, snapshotTrigger &trigger);
+
+// Per-ROM cache of the machine state at a trigger point, so runs can skip
+// a ROM's intro. Snapshots live in a directory, one file per ROM hash and
+// trigger, and are always taken on a frame boundary. A run started from one
+// matches a run that booted and got there by itself, except that CXNN
+// draws from the snapshot on follow the run's own seed: the generator is
+// re-seeded on restore, as each run seeds it afresh anyway. No snapshot is
+// taken if a key is pressed before the trigger, since the state could then
+// depend on that run's input.
+class bootSnapshot {
+private:
+  std::string path;
+  uint64_t rom; // romHash of the freshly loaded cpu, folded with its quirks
+  snapshotTrigger trigger;
+  bool armed;      // still running towards the trigger
+  uint64_t frames; // frames run since boot
+
+  void take(const cpu &c);
+
+public:
+  bootSnapshot() : rom(0), armed(false), frames(0) {}
+
+  // Restores the cached snapshot for this ROM into c, re-seeded with seed,
+  // and returns true, or arms the trigger so one is taken this run. c must
+  // be freshly loaded.
+  bool open(const char *dir, const snapshotTrigger &when, uint32_t seed,
+            cpu &c);
+  bool pending() const { return armed; }
+  // Runs a frame while pending, watching for the trigger; returns whether
+  // sound is on, like cpu::runFrame
+  bool runFrame(cpu &c, int ipf);
+};
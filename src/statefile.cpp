@@ -0,0 +1,144 @@
+#include "statefile.h"
+#include "log.h"
+#include <atomic>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <type_traits>
+#include <unistd.h>
+
+static_assert(std::is_trivially_copyable<cpu>::value,
+              "cpu state is copied in and out of the mapping as bytes");
+
+const uint32_t STATE_MAGIC = 0x38504843; // "CHP8"
+const uint32_t STATE_VERSION = 1;
+
+struct stateFile::layout {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t cpuSize; // catches a cpu layout change without a version bump
+  uint32_t reserved;
+  uint64_t rom;
+  uint64_t generation; // 0 = empty; slot generation & 1 is the latest
+  cpu slots[2];
+};
+
+uint64_t romHash(const cpu &c) {
+  uint64_t hash = 0xCBF29CE484222325ull; // FNV-1a
+  for (uint16_t addr = 0; addr < 4096; addr++) {
+    hash ^= c.readMemory(addr);
+    hash *= 0x100000001B3ull;
+  }
+  return hash;
+}
+
+bool stateFile::open(const char *path, uint64_t rom) {
+  close();
+  fd = ::open(path, O_RDWR | O_CREAT, 0644);
+  if (fd < 0) {
+    LOG_ERROR("state_open_failed", "path", path);
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 ||
+      (st.st_size != (off_t)sizeof(layout) &&
+       ftruncate(fd, sizeof(layout)) != 0)) {
+    LOG_ERROR("state_resize_failed", "path", path);
+    close();
+    return false;
+  }
+  void *p = mmap(NULL, sizeof(layout), PROT_READ | PROT_WRITE, MAP_SHARED,
+                 fd, 0);
+  if (p == MAP_FAILED) {
+    LOG_ERROR("state_map_failed", "path", path);
+    close();
+    return false;
+  }
+  map = static_cast<layout *>(p);
+  if (map->magic != STATE_MAGIC || map->version != STATE_VERSION ||
+      map->cpuSize != sizeof(cpu) || map->rom != rom) {
+    if (map->magic == STATE_MAGIC) {
+      LOG_INFO("state_reset", "path", path, "reason", "rom or version");
+    }
+    map->magic = STATE_MAGIC;
+    map->version = STATE_VERSION;
+    map->cpuSize = sizeof(cpu);
+    map->reserved = 0;
+    map->rom = rom;
+    map->generation = 0;
+  }
+  return true;
+}
+
+bool stateFile::restore(cpu &c) const {
+  if (map == nullptr) {
+    return false;
+  }
+  uint64_t gen = std::atomic_ref<uint64_t>(map->generation)
+                     .load(std::memory_order_acquire);
+  if (gen == 0) {
+    return false;
+  }
+  c = map->slots[gen & 1];
+  LOG_INFO("state_restored", "generation", gen, "pc", logging::hex(c.getPC()));
+  return true;
+}
+
+bool stateFile::load(const char *path, uint64_t rom, cpu &c) {
+  int in = ::open(path, O_RDONLY);
+  if (in < 0) {
+    return false;
+  }
+  struct stat st;
+  void *p = MAP_FAILED;
+  if (fstat(in, &st) == 0 && st.st_size == (off_t)sizeof(layout)) {
+    p = mmap(NULL, sizeof(layout), PROT_READ, MAP_SHARED, in, 0);
+  }
+  ::close(in);
+  if (p == MAP_FAILED) {
+    return false;
+  }
+  layout *m = static_cast<layout *>(p);
+  bool ok = m->magic == STATE_MAGIC && m->version == STATE_VERSION &&
+            m->cpuSize == sizeof(cpu) && m->rom == rom;
+  if (ok) {
+    uint64_t gen = std::atomic_ref<uint64_t>(m->generation)
+                       .load(std::memory_order_acquire);
+    ok = gen != 0;
+    if (ok) {
+      c = m->slots[gen & 1];
+    }
+  }
+  munmap(p, sizeof(layout));
+  return ok;
+}
+
+void stateFile::save(const cpu &c) {
+  if (map == nullptr) {
+    return;
+  }
+  std::atomic_ref<uint64_t> gen(map->generation);
+  uint64_t next = gen.load(std::memory_order_relaxed) + 1;
+  map->slots[next & 1] = c;
+  gen.store(next, std::memory_order_release);
+}
+
+void stateFile::discard() {
+  if (map != nullptr) {
+    std::atomic_ref<uint64_t>(map->generation)
+        .store(0, std::memory_order_release);
+  }
+}
+
+void stateFile::close() {
+  if (map != nullptr) {
+    msync(map, sizeof(layout), MS_SYNC);
+    munmap(map, sizeof(layout));
+    map = nullptr;
+  }
+  if (fd >= 0) {
+    ::close(fd);
+    fd = -1;
+  }
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include "cpu.h"
+#include <cstdint>
+
+// Hash of a freshly loaded cpu's memory (font + program). Identifies the
+// ROM a saved state belongs to.
+uint64_t romHash(const cpu &c);
+
+// A cpu state kept in a memory-mapped file so a session can be resumed
+// where it was left. The file holds two cpu slots and a generation count;
+// save() writes the idle slot and then bumps the generation, so a process
+// killed mid-save still leaves the previous state intact. Saving is a
+// memcpy into the page cache and cheap enough to do every frame.
+class stateFile {
+private:
+  struct layout;
+  layout *map;
+  int fd;
+
+public:
+  stateFile() : map(nullptr), fd(-1) {}
+  ~stateFile() { close(); }
+  stateFile(const stateFile &) = delete;
+  stateFile &operator=(const stateFile &) = delete;
+
+  // Maps path, creating it if needed. A file written for another ROM or
+  // build is reset so it is never restored.
+  bool open(const char *path, uint64_t rom);
+  // Copies the last saved cpu out of the mapping; false if there is none
+  bool restore(cpu &c) const;
+  // Reads the last state saved in path into c without opening it for
+  // writing, so a file of another ROM or build is left as it is; false if
+  // there is none
+  static bool load(const char *path, uint64_t rom, cpu &c);
+  void save(const cpu &c);
+  // Forgets the saved state, e.g. after the program crashed
+  void discard();
+  // Flushes the mapping to disk and unmaps it
+  void close();
+};
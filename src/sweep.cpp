@@ -0,0 +1,676 @@
+#include "sweep.h"
+#include "checkpoint.h"
+#include "log.h"
+#include "migrate.h"
+#include "statefile.h"
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+const int MAX_ATTEMPTS = 2;
+const int CHECKPOINT_INTERVAL_S = 10;
+const uint32_t CHECKPOINT_MAGIC = 0x57533843; // "C8SW"
+const uint32_t CHECKPOINT_VERSION = 2;
+const int MIGRATE_AFTER_S = 2;          // busy this long while others idle
+const uint32_t MIGRATE_POLL_FRAMES = 256; // worker checks for a request
+const size_t MAX_INSTANCE = 8192;       // bound on an encoded seedRun
+
+namespace {
+
+enum jobState { JOB_PENDING, JOB_DONE, JOB_FAILED };
+
+// Seeds [firstSeed, firstSeed + seeds) of one ROM x script cell, after
+// finishing the run in `instance` if a migration left one
+struct job {
+  uint32_t rom;
+  uint32_t script;
+  uint32_t firstSeed;
+  uint32_t seeds;
+  int attempts;
+  int lastStatus; // wait status of the worker that last died running it
+  int state;      // jobState
+  std::vector<uint8_t> instance; // encodeRun() of a paused run, or empty
+};
+
+// Checkpoint image: header, one record per job followed by its paused
+// run, then the totals of every ROM x script cell
+struct checkpointHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t matrix; // hash of everything that defines the jobs
+  uint32_t jobs;
+  uint32_t cells;
+};
+
+struct jobRecord {
+  uint32_t rom;
+  uint32_t script;
+  uint32_t firstSeed;
+  uint32_t seeds;
+  int32_t state;
+  int32_t attempts;
+  int32_t lastStatus;
+  uint32_t instanceSize;
+};
+
+std::atomic<bool> interrupted(false);
+
+void onInterrupt(int) { interrupted = true; }
+
+// Hand-off protocol, one SOCK_SEQPACKET message each:
+//   supervisor -> worker  MSG_JOB      jobMessage + paused run, if any
+//   supervisor -> worker  MSG_MIGRATE  type only; ignored when idle
+//   worker -> supervisor  MSG_RESULT   resultMessage, job complete
+//   worker -> supervisor  MSG_HANDOFF  resultMessage + paused run: totals
+//                                      so far, the rest is given back
+enum messageType { MSG_JOB, MSG_MIGRATE, MSG_RESULT, MSG_HANDOFF };
+
+struct jobMessage {
+  uint32_t type;
+  uint32_t id;
+  uint32_t rom;
+  uint32_t script;
+  uint32_t firstSeed;
+  uint32_t seeds;
+  uint32_t instanceSize;
+};
+
+struct resultMessage {
+  uint32_t type;
+  uint32_t id;
+  uint32_t nextSeed;  // HANDOFF: first seed not started
+  uint32_t seedsLeft; // HANDOFF: seeds not started
+  uint32_t instanceSize;
+  monteCarloTotals totals;
+};
+
+struct worker {
+  pid_t pid;
+  int fd;
+  int job; // -1 when idle
+  bool migrating; // asked to hand its job back
+  std::chrono::steady_clock::time_point started;
+};
+
+bool migrateRequested(int fd) {
+  uint32_t type;
+  ssize_t n;
+  while ((n = recv(fd, &type, sizeof(type), MSG_DONTWAIT)) > 0) {
+    if (n == (ssize_t)sizeof(type) && type == MSG_MIGRATE) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Child side: run jobs until the supervisor closes the socket. Never
+// returns; skips exit handlers that belong to the parent (e.g. the log
+// flusher thread, which does not exist in the child).
+[[noreturn]] void workerMain(int fd, const sweepMatrix &matrix, int ipf) {
+  static char in[sizeof(jobMessage) + MAX_INSTANCE];
+  static char out[sizeof(resultMessage) + MAX_INSTANCE];
+  ssize_t n;
+  while ((n = recv(fd, in, sizeof(in), 0)) >= (ssize_t)sizeof(uint32_t)) {
+    jobMessage msg;
+    memcpy(&msg, in, n < (ssize_t)sizeof(msg) ? n : sizeof(msg));
+    if (msg.type != MSG_JOB) {
+      continue; // a migrate request that crossed with our result
+    }
+    const sweepRom &rom = matrix.roms[msg.rom];
+    const inputScript &script = matrix.scripts[msg.script].script;
+    monteCarloConfig config;
+    config.firstSeed = msg.firstSeed;
+    config.seeds = msg.seeds;
+    config.frames = matrix.frames;
+    config.ipf = ipf;
+    config.threads = 1; // parallelism comes from the processes
+    config.score = rom.score;
+    config.ir = false;
+
+    resultMessage result;
+    result.type = MSG_RESULT;
+    result.id = msg.id;
+    result.instanceSize = 0;
+    seedRun run;
+    bool active = msg.instanceSize > 0;
+    if (active && !decodeRun((const uint8_t *)in + sizeof(msg),
+                             msg.instanceSize, rom.boot, run)) {
+      _exit(2);
+    }
+    uint32_t next = msg.firstSeed;
+    uint32_t left = msg.seeds;
+    uint32_t sinceCheck = 0;
+    while (active || left > 0) {
+      if (!active) {
+        run.start(rom.boot, next++);
+        left--;
+        active = true;
+      }
+      if (!run.step(script, config)) {
+        run.record(config, result.totals);
+        active = false;
+      }
+      if (++sinceCheck == MIGRATE_POLL_FRAMES) {
+        sinceCheck = 0;
+        if (migrateRequested(fd)) {
+          result.type = MSG_HANDOFF;
+          break;
+        }
+      }
+    }
+    result.nextSeed = next;
+    result.seedsLeft = left;
+    if (active) {
+      std::vector<uint8_t> blob = encodeRun(run, rom.boot);
+      if (blob.size() > MAX_INSTANCE) {
+        _exit(3);
+      }
+      result.instanceSize = blob.size();
+      memcpy(out + sizeof(result), blob.data(), blob.size());
+    }
+    memcpy(out, &result, sizeof(result));
+    size_t size = sizeof(result) + result.instanceSize;
+    if (send(fd, out, size, MSG_NOSIGNAL) != (ssize_t)size) {
+      break;
+    }
+  }
+  _exit(0);
+}
+
+bool spawn(worker &w, std::vector<worker> &pool, const sweepMatrix &matrix,
+           int ipf) {
+  int sv[2];
+  if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv) != 0) {
+    LOG_ERROR("sweep_socket_failed", "errno", errno);
+    return false;
+  }
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid < 0) {
+    LOG_ERROR("sweep_fork_failed", "errno", errno);
+    close(sv[0]);
+    close(sv[1]);
+    return false;
+  }
+  if (pid == 0) {
+    // ^C goes to the whole process group; the supervisor decides
+    signal(SIGINT, SIG_IGN);
+    signal(SIGTERM, SIG_DFL);
+    close(sv[0]);
+    for (size_t i = 0; i < pool.size(); i++) {
+      if (pool[i].fd >= 0) {
+        close(pool[i].fd);
+      }
+    }
+    workerMain(sv[1], matrix, ipf);
+  }
+  close(sv[1]);
+  w.pid = pid;
+  w.fd = sv[0];
+  w.job = -1;
+  w.migrating = false;
+  return true;
+}
+
+bool sendJob(const worker &w, uint32_t id, const job &j) {
+  static char out[sizeof(jobMessage) + MAX_INSTANCE];
+  jobMessage msg = {MSG_JOB,     id,        j.rom,
+                    j.script,    j.firstSeed, j.seeds,
+                    (uint32_t)j.instance.size()};
+  memcpy(out, &msg, sizeof(msg));
+  memcpy(out + sizeof(msg), j.instance.data(), j.instance.size());
+  size_t size = sizeof(msg) + j.instance.size();
+  return send(w.fd, out, size, MSG_NOSIGNAL) == (ssize_t)size;
+}
+
+uint64_t matrixHash(const sweepMatrix &matrix, int ipf) {
+  uint64_t parts[] = {matrix.roms.size(), matrix.scripts.size(),
+                      matrix.firstSeed,   matrix.lastSeed,
+                      matrix.frames,      matrix.chunk,
+                      (uint64_t)ipf};
+  uint64_t hash = 0xCBF29CE484222325ull;
+  auto mix = [&hash](uint64_t v) { hash = (hash ^ v) * 0x100000001B3ull; };
+  for (uint64_t p : parts) {
+    mix(p);
+  }
+  for (size_t i = 0; i < matrix.roms.size(); i++) {
+    const sweepRom &rom = matrix.roms[i];
+    mix(romHash(rom.boot));
+    mix(rom.boot.quirks.displayWait);
+    mix(rom.score.enabled ? rom.score.addr << 1 | rom.score.bcd : 0xFFFFF);
+  }
+  for (size_t i = 0; i < matrix.scripts.size(); i++) {
+    mix(matrix.scripts[i].script.hash());
+  }
+  return hash;
+}
+
+std::vector<char> saveImage(uint64_t matrix, const std::vector<job> &jobs,
+                            const std::vector<monteCarloTotals> &cells) {
+  checkpointHeader header = {CHECKPOINT_MAGIC, CHECKPOINT_VERSION, matrix,
+                             (uint32_t)jobs.size(), (uint32_t)cells.size()};
+  size_t size = sizeof(header) + cells.size() * sizeof(monteCarloTotals);
+  for (size_t i = 0; i < jobs.size(); i++) {
+    size += sizeof(jobRecord) + jobs[i].instance.size();
+  }
+  std::vector<char> image(size);
+  char *p = image.data();
+  memcpy(p, &header, sizeof(header));
+  p += sizeof(header);
+  for (size_t i = 0; i < jobs.size(); i++) {
+    const job &j = jobs[i];
+    jobRecord r = {j.rom,   j.script,   j.firstSeed, j.seeds, j.state,
+                   j.attempts, j.lastStatus, (uint32_t)j.instance.size()};
+    memcpy(p, &r, sizeof(r));
+    p += sizeof(r);
+    memcpy(p, j.instance.data(), j.instance.size());
+    p += j.instance.size();
+  }
+  memcpy(p, cells.data(), cells.size() * sizeof(monteCarloTotals));
+  return image;
+}
+
+// Restores the job list and totals; false if the image belongs to another
+// matrix or is damaged, in which case nothing is changed
+bool loadImage(const std::vector<char> &image, uint64_t matrix,
+               const sweepMatrix &sweep, std::vector<job> &jobs,
+               std::vector<monteCarloTotals> &cells) {
+  checkpointHeader header;
+  if (image.size() < sizeof(header)) {
+    return false;
+  }
+  memcpy(&header, image.data(), sizeof(header));
+  if (header.magic != CHECKPOINT_MAGIC ||
+      header.version != CHECKPOINT_VERSION || header.matrix != matrix ||
+      header.cells != cells.size()) {
+    return false;
+  }
+  const char *p = image.data() + sizeof(header);
+  const char *end = image.data() + image.size();
+  std::vector<job> loaded;
+  for (uint32_t i = 0; i < header.jobs; i++) {
+    jobRecord r;
+    if ((size_t)(end - p) < sizeof(r)) {
+      return false;
+    }
+    memcpy(&r, p, sizeof(r));
+    p += sizeof(r);
+    if (r.rom >= sweep.roms.size() || r.script >= sweep.scripts.size() ||
+        r.instanceSize > MAX_INSTANCE || (size_t)(end - p) < r.instanceSize) {
+      return false;
+    }
+    job j = {r.rom,      r.script,     r.firstSeed, r.seeds,
+             r.attempts, r.lastStatus, r.state,     {}};
+    j.instance.assign(p, p + r.instanceSize);
+    p += r.instanceSize;
+    loaded.push_back(std::move(j));
+  }
+  if ((size_t)(end - p) != cells.size() * sizeof(monteCarloTotals)) {
+    return false;
+  }
+  memcpy((void *)cells.data(), p, cells.size() * sizeof(monteCarloTotals));
+  jobs.swap(loaded);
+  return true;
+}
+
+const char *scriptName(const sweepMatrix &matrix, uint32_t script) {
+  const std::string &path = matrix.scripts[script].path;
+  return path.empty() ? "none" : path.c_str();
+}
+
+} // namespace
+
+bool loadSweep(const char *path, const quirkConfig &quirks,
+               sweepMatrix &matrix) {
+  FILE *file = fopen(path, "r");
+  if (file == NULL) {
+    LOG_ERROR("sweep_open_failed", "path", path);
+    return false;
+  }
+  matrix.roms.clear();
+  matrix.scripts.clear();
+  matrix.firstSeed = 1;
+  matrix.lastSeed = 1;
+  matrix.frames = 3600;
+  matrix.chunk = 64;
+  matrix.timeout = 600;
+  char line[512];
+  int lineNo = 0;
+  bool ok = true;
+  while (ok && fgets(line, sizeof(line), file) != NULL) {
+    lineNo++;
+    // keyword, then the rest of the line (paths may contain spaces)
+    char *key = line + strspn(line, " \t");
+    char *arg = key + strcspn(key, " \t\r\n");
+    if (*key == '#' || arg == key) {
+      continue;
+    }
+    if (*arg != '\0') {
+      *arg++ = '\0';
+      arg += strspn(arg, " \t");
+    }
+    arg[strcspn(arg, "\r\n")] = '\0';
+    size_t len = strlen(arg);
+    while (len > 0 && (arg[len - 1] == ' ' || arg[len - 1] == '\t')) {
+      arg[--len] = '\0';
+    }
+    int fields = len > 0 ? 2 : 1;
+    unsigned long a = 0, b = 0;
+    if (strcmp(key, "rom") == 0 && fields == 2) {
+      sweepRom rom;
+      rom.path = arg;
+      rom.boot = BOOT_STATE;
+      rom.boot.quirks = quirks;
+      rom.score.enabled = false;
+      ok = rom.boot.loadRom(arg);
+      matrix.roms.push_back(rom);
+    } else if (strcmp(key, "score") == 0 && fields == 2 &&
+               !matrix.roms.empty()) {
+      ok = parseScoreLocation(arg, matrix.roms.back().score);
+    } else if (strcmp(key, "script") == 0 && fields == 2) {
+      sweepScript script;
+      if (strcmp(arg, "none") != 0) {
+        script.path = arg;
+        ok = script.script.load(arg);
+      }
+      matrix.scripts.push_back(script);
+    } else if (strcmp(key, "seeds") == 0 && fields == 2 &&
+               sscanf(arg, "%lu-%lu", &a, &b) == 2 && a <= b) {
+      matrix.firstSeed = a;
+      matrix.lastSeed = b;
+    } else if (strcmp(key, "frames") == 0 && fields == 2 &&
+               (a = strtoul(arg, NULL, 10)) > 0) {
+      matrix.frames = a;
+    } else if (strcmp(key, "chunk") == 0 && fields == 2 &&
+               (a = strtoul(arg, NULL, 10)) > 0) {
+      matrix.chunk = a;
+    } else if (strcmp(key, "timeout") == 0 && fields == 2 &&
+               (a = strtoul(arg, NULL, 10)) > 0) {
+      matrix.timeout = a;
+    } else {
+      ok = false;
+    }
+    if (!ok) {
+      LOG_ERROR("sweep_bad_line", "path", path, "line", lineNo);
+    }
+  }
+  fclose(file);
+  if (matrix.scripts.empty()) {
+    matrix.scripts.push_back(sweepScript());
+  }
+  if (ok && matrix.roms.empty()) {
+    LOG_ERROR("sweep_no_roms", "path", path);
+    ok = false;
+  }
+  return ok;
+}
+
+bool runSweep(const sweepMatrix &matrix, int workers, int ipf,
+              const char *checkpoint) {
+  std::vector<job> jobs;
+  for (uint32_t r = 0; r < matrix.roms.size(); r++) {
+    for (uint32_t s = 0; s < matrix.scripts.size(); s++) {
+      uint64_t seed = matrix.firstSeed;
+      while (seed <= matrix.lastSeed) {
+        uint64_t left = (uint64_t)matrix.lastSeed - seed + 1;
+        job j = {r, s, (uint32_t)seed,
+                 (uint32_t)(left < matrix.chunk ? left : matrix.chunk), 0, 0,
+                 JOB_PENDING, {}};
+        jobs.push_back(j);
+        seed += j.seeds;
+      }
+    }
+  }
+  std::vector<monteCarloTotals> cells(matrix.roms.size() *
+                                      matrix.scripts.size());
+  uint64_t hash = matrixHash(matrix, ipf);
+  checkpointWriter writer;
+  if (checkpoint != NULL) {
+    std::vector<char> image;
+    if (readCheckpoint(checkpoint, image)) {
+      if (!loadImage(image, hash, matrix, jobs, cells)) {
+        LOG_ERROR("checkpoint_mismatch", "path", checkpoint);
+        return false;
+      }
+      LOG_INFO("checkpoint_resumed", "path", checkpoint);
+    }
+    writer.start(checkpoint);
+  }
+
+  std::deque<uint32_t> queue;
+  std::vector<uint32_t> failed;
+  size_t finished = 0;
+  int restarts = 0;
+  for (uint32_t i = 0; i < jobs.size(); i++) {
+    if (jobs[i].state == JOB_PENDING) {
+      queue.push_back(i);
+    } else if (jobs[i].state == JOB_DONE) {
+      finished++;
+    } else {
+      failed.push_back(i);
+    }
+  }
+  if (finished + failed.size() > 0) {
+    printf("resuming: %zu of %zu jobs already done\n",
+           finished + failed.size(), jobs.size());
+  }
+  if (workers <= 0) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    workers = cpus > 0 ? cpus : 1;
+  }
+  if ((size_t)workers > queue.size()) {
+    workers = queue.size() > 0 ? queue.size() : 1;
+  }
+
+  interrupted = false;
+  struct sigaction action = {}, oldInt, oldTerm;
+  action.sa_handler = onInterrupt;
+  sigaction(SIGINT, &action, &oldInt);
+  sigaction(SIGTERM, &action, &oldTerm);
+  auto lastCheckpoint = std::chrono::steady_clock::now();
+  bool dirty = false;
+
+  std::vector<worker> pool(workers, worker{-1, -1, -1, false, {}});
+  for (size_t i = 0; i < pool.size(); i++) {
+    if (!spawn(pool[i], pool, matrix, ipf)) {
+      return false;
+    }
+  }
+  int migrations = 0;
+  static char in[sizeof(resultMessage) + MAX_INSTANCE];
+
+  std::vector<pollfd> fds(pool.size());
+  bool ok = true;
+  while (ok && !interrupted && finished + failed.size() < jobs.size()) {
+    auto now = std::chrono::steady_clock::now();
+    if (checkpoint != NULL && dirty &&
+        now - lastCheckpoint > std::chrono::seconds(CHECKPOINT_INTERVAL_S)) {
+      writer.submit(saveImage(hash, jobs, cells));
+      lastCheckpoint = now;
+      dirty = false;
+    }
+    int idle = 0;
+    worker *straggler = NULL;
+    for (size_t i = 0; i < pool.size(); i++) {
+      worker &w = pool[i];
+      if (w.job < 0 && !queue.empty()) {
+        if (sendJob(w, queue.front(), jobs[queue.front()])) {
+          w.job = queue.front();
+          w.started = now;
+          w.migrating = false;
+          queue.pop_front();
+        }
+      } else if (w.job < 0) {
+        idle++;
+      } else if (!w.migrating && jobs[w.job].seeds > 0 &&
+                 now - w.started > std::chrono::seconds(MIGRATE_AFTER_S) &&
+                 (straggler == NULL || w.started < straggler->started)) {
+        straggler = &w;
+      }
+      if (w.job >= 0 &&
+          now - w.started > std::chrono::seconds(matrix.timeout)) {
+        LOG_WARN("sweep_job_timeout", "job", w.job, "pid", (int)w.pid);
+        kill(w.pid, SIGKILL); // reaped below once the socket hangs up
+      }
+      fds[i].fd = w.fd;
+      fds[i].events = POLLIN;
+      fds[i].revents = 0;
+    }
+    // Tail of the sweep: rather than leave workers idle behind a slow one,
+    // have it hand back its paused run and unstarted seeds for sharing out
+    if (idle > 0 && straggler != NULL) {
+      uint32_t type = MSG_MIGRATE;
+      if (send(straggler->fd, &type, sizeof(type), MSG_NOSIGNAL) ==
+          (ssize_t)sizeof(type)) {
+        straggler->migrating = true;
+      }
+    }
+    if (poll(fds.data(), fds.size(), 1000) < 0 && errno != EINTR) {
+      LOG_ERROR("sweep_poll_failed", "errno", errno);
+      ok = false;
+      break;
+    }
+    for (size_t i = 0; i < pool.size(); i++) {
+      if (fds[i].revents == 0) {
+        continue;
+      }
+      worker &w = pool[i];
+      resultMessage result;
+      ssize_t n = recv(w.fd, in, sizeof(in), MSG_DONTWAIT);
+      if (n >= (ssize_t)sizeof(result)) {
+        memcpy(&result, in, sizeof(result));
+      }
+      if (n >= (ssize_t)sizeof(result) && (int)result.id == w.job &&
+          n == (ssize_t)(sizeof(result) + result.instanceSize)) {
+        job &j = jobs[result.id];
+        cells[j.rom * matrix.scripts.size() + j.script].merge(result.totals);
+        dirty = true;
+        w.job = -1;
+        if (result.type == MSG_HANDOFF &&
+            (result.instanceSize > 0 || result.seedsLeft > 0)) {
+          // the paused run stays with this job, half the seeds go to a new
+          // one; both run on whichever workers are free
+          migrations++;
+          j.firstSeed = result.nextSeed;
+          j.seeds = result.seedsLeft;
+          j.instance.assign(in + sizeof(result),
+                            in + sizeof(result) + result.instanceSize);
+          uint32_t id = result.id;
+          if (j.seeds >= 2) {
+            job rest = j;
+            rest.instance.clear();
+            rest.seeds = j.seeds - j.seeds / 2;
+            rest.firstSeed = j.firstSeed + j.seeds / 2;
+            j.seeds /= 2;
+            jobs.push_back(std::move(rest)); // invalidates j
+            queue.push_front(jobs.size() - 1);
+          }
+          queue.push_front(id);
+          continue;
+        }
+        j.state = JOB_DONE;
+        j.instance.clear();
+        finished++;
+        continue;
+      }
+      if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+        continue;
+      }
+      // hung up or sent garbage: the worker is gone, take its job back
+      int status = 0;
+      close(w.fd);
+      kill(w.pid, SIGKILL);
+      waitpid(w.pid, &status, 0);
+      if (w.job >= 0 && interrupted) {
+        queue.push_front(w.job); // not the job's fault
+      } else if (w.job >= 0) {
+        job &j = jobs[w.job];
+        j.attempts++;
+        j.lastStatus = status;
+        LOG_WARN("sweep_worker_died", "pid", (int)w.pid, "job", w.job,
+                 "signal", WIFSIGNALED(status) ? WTERMSIG(status) : 0);
+        if (j.attempts < MAX_ATTEMPTS) {
+          queue.push_front(w.job);
+        } else {
+          j.state = JOB_FAILED;
+          failed.push_back(w.job);
+        }
+        dirty = true;
+      }
+      w.fd = -1;
+      restarts++;
+      if (!spawn(w, pool, matrix, ipf)) {
+        w.pid = -1;
+        ok = false;
+        break;
+      }
+    }
+  }
+
+  for (size_t i = 0; i < pool.size(); i++) {
+    if (pool[i].fd >= 0) {
+      close(pool[i].fd); // worker sees EOF and exits
+    }
+    if (interrupted && pool[i].pid > 0) {
+      kill(pool[i].pid, SIGKILL); // abandon in-flight jobs
+    }
+  }
+  for (size_t i = 0; i < pool.size(); i++) {
+    if (pool[i].pid > 0) {
+      waitpid(pool[i].pid, NULL, 0);
+    }
+  }
+  sigaction(SIGINT, &oldInt, NULL);
+  sigaction(SIGTERM, &oldTerm, NULL);
+  if (checkpoint != NULL) {
+    writer.submit(saveImage(hash, jobs, cells));
+    if (!writer.stop()) {
+      ok = false;
+    }
+  }
+  if (interrupted) {
+    printf("interrupted: %zu of %zu jobs done, checkpoint %s\n",
+           finished + failed.size(), jobs.size(),
+           checkpoint != NULL ? checkpoint : "not kept");
+    return false;
+  }
+
+  printf("%zu jobs on %d workers, %d migrations, %d restarts, %zu failed\n",
+         jobs.size(), workers, migrations, restarts, failed.size());
+  for (uint32_t r = 0; r < matrix.roms.size(); r++) {
+    for (uint32_t s = 0; s < matrix.scripts.size(); s++) {
+      const monteCarloTotals &t = cells[r * matrix.scripts.size() + s];
+      bool score = matrix.roms[r].score.enabled;
+      monteCarloResult res = summarize(t, score);
+      printf("%s\t%s\truns %llu\tcrashed %llu\tfinished %llu\tframes %.1f",
+             matrix.roms[r].path.c_str(), scriptName(matrix, s),
+             (unsigned long long)res.runs, (unsigned long long)res.crashes,
+             (unsigned long long)res.finished,
+             res.runs ? (double)res.framesTotal / res.runs : 0.0);
+      if (score) {
+        printf("\tscore mean %.2f p50 %u p90 %u", res.scoreMean, res.scoreP50,
+               res.scoreP90);
+      }
+      printf("\n");
+    }
+  }
+  for (size_t i = 0; i < failed.size(); i++) {
+    const job &j = jobs[failed[i]];
+    printf("FAILED\t%s\t%s\tseeds %u-%u\t%s %d\n",
+           matrix.roms[j.rom].path.c_str(), scriptName(matrix, j.script),
+           j.firstSeed, j.firstSeed + j.seeds - 1,
+           WIFSIGNALED(j.lastStatus) ? "signal" : "exit",
+           WIFSIGNALED(j.lastStatus) ? WTERMSIG(j.lastStatus)
+                                     : WEXITSTATUS(j.lastStatus));
+  }
+  return ok && failed.empty();
+}
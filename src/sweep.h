@@ -0,0 +1,53 @@
+#pragma once
+#include "cpu.h"
+#include "montecarlo.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// A ROM x input script x seed matrix, read from a text file:
+//   rom PATH           one per ROM
+//   score SPEC         score location of the ROM above, as for --score
+//   script PATH        one per input script; "script none" runs without
+//   seeds FIRST-LAST
+//   frames N           per run (default 3600)
+//   chunk N            seeds per job (default 64)
+//   timeout SECONDS    a job running longer kills its worker (default 600)
+// Lines starting with '#' are comments.
+struct sweepRom {
+  std::string path;
+  cpu boot; // loaded, not yet run
+  scoreLocation score;
+};
+
+struct sweepScript {
+  std::string path;
+  inputScript script;
+};
+
+struct sweepMatrix {
+  std::vector<sweepRom> roms;
+  std::vector<sweepScript> scripts;
+  uint32_t firstSeed;
+  uint32_t lastSeed;
+  uint32_t frames;
+  uint32_t chunk;
+  uint32_t timeout;
+};
+
+bool loadSweep(const char *path, const quirkConfig &quirks,
+               sweepMatrix &matrix);
+
+// Shards the matrix into jobs of `chunk` seeds and runs them in forked
+// worker processes fed over Unix sockets. A worker that crashes or times
+// out is replaced and its job retried once. A job that fails twice is
+// reported and skipped, and the rest of the sweep carries on. Prints the
+// merged outcome for every ROM and script. Returns false if any job failed
+// or the sweep was interrupted.
+//
+// With a checkpoint path, job progress and the merged totals are saved in
+// the background every few seconds and when the sweep stops (including on
+// SIGINT/SIGTERM). Rerunning the same matrix with the same checkpoint
+// continues with the jobs that had not finished.
+bool runSweep(const sweepMatrix &matrix, int workers, int ipf,
+              const char *checkpoint);
@@ -0,0 +1,201 @@
+#include "timeline.h"
+
+void timeline::init(int framesIPF, size_t checkpoints) {
+  ipf = framesIPF;
+  maxCheckpoints = checkpoints < 3 ? 3 : checkpoints;
+  slots.clear();
+  index.clear();
+  freeSlots.clear();
+  inputs.clear();
+  // recording must not allocate mid-session; a checkpoint is added before
+  // thinning drops one, so there is one more than kept
+  slots.reserve(maxCheckpoints + 1);
+  index.reserve(maxCheckpoints + 1);
+  freeSlots.reserve(maxCheckpoints + 1);
+  inputs.assign(INPUT_HISTORY_FRAMES, 0);
+  frames = 0;
+  firstFrame = 0;
+  posFrame = 0;
+  posInstr = 0;
+  paused = false;
+}
+
+void timeline::record(const cpu &c) {
+  uint16_t mask = 0;
+  for (int i = 0; i < 16; i++) {
+    if (c.key[i]) {
+      mask |= 1 << i;
+    }
+  }
+  if (frames - firstFrame == inputs.size()) {
+    forgetOldest();
+  }
+  inputs[frames % inputs.size()] = mask;
+  checkpoint(c, frames);
+  frames++;
+  posFrame = frames;
+  posInstr = 0;
+}
+
+void timeline::checkpoint(const cpu &c, uint64_t frame) {
+  entry e;
+  e.frame = frame;
+  if (!freeSlots.empty()) {
+    e.slot = freeSlots.back();
+    freeSlots.pop_back();
+    slots[e.slot] = c;
+  } else {
+    e.slot = slots.size();
+    slots.push_back(c);
+  }
+  index.push_back(e);
+  if (index.size() > maxCheckpoints) {
+    thin();
+  }
+}
+
+// Drops the checkpoint whose removal leaves the smallest gap relative to
+// its age, so spacing ends up roughly proportional to distance from now.
+// The oldest and newest checkpoints are always kept.
+void timeline::thin() {
+  uint64_t now = index.back().frame;
+  size_t victim = 1;
+  double best = -1;
+  for (size_t i = 1; i + 1 < index.size(); i++) {
+    double gap = index[i + 1].frame - index[i - 1].frame;
+    double cost = gap / (double)(now - index[i].frame + 1);
+    if (best < 0 || cost < best) {
+      best = cost;
+      victim = i;
+    }
+  }
+  freeSlots.push_back(index[victim].slot);
+  index.erase(index.begin() + victim);
+}
+
+// Makes room in the input ring by dropping the oldest checkpoint; history
+// then starts at the next one. The newest is always a frame ago, so there
+// are at least two.
+void timeline::forgetOldest() {
+  freeSlots.push_back(index.front().slot);
+  index.erase(index.begin());
+  firstFrame = index.front().frame;
+}
+
+void timeline::applyInput(cpu &c, uint64_t frame) const {
+  uint16_t mask = inputs[frame % inputs.size()];
+  for (int i = 0; i < 16; i++) {
+    c.prevKeys[i] = c.key[i];
+    c.key[i] = (mask >> i) & 1;
+  }
+}
+
+// Restores the nearest checkpoint at or before frame and replays to the
+// given instruction of that frame
+void timeline::seek(cpu &c, uint64_t frame, int instr) {
+  size_t best = 0;
+  for (size_t i = 0; i < index.size() && index[i].frame <= frame; i++) {
+    best = i;
+  }
+  c = slots[index[best].slot];
+  for (uint64_t f = index[best].frame; f < frame; f++) {
+    c.runFrame(ipf);
+    applyInput(c, f + 1);
+  }
+  int executed = 0;
+  if (instr > 0) {
+    c.vblank();
+    while (executed < instr && executed < ipf) {
+      c.executeCycle();
+      executed++;
+      if (c.breakIPF || !c.running) {
+        break;
+      }
+    }
+  }
+  posFrame = frame;
+  posInstr = executed;
+  c.draw = true;
+}
+
+// Number of instructions the given frame executes
+int timeline::frameLength(cpu &c, uint64_t frame) {
+  seek(c, frame, ipf);
+  return posInstr;
+}
+
+bool timeline::stepBackFrame(cpu &c) {
+  if (index.empty()) {
+    return false;
+  }
+  paused = true;
+  if (posInstr > 0) {
+    seek(c, posFrame, 0);
+  } else if (posFrame > index.front().frame) {
+    seek(c, posFrame - 1, 0);
+  } else {
+    return false;
+  }
+  return true;
+}
+
+bool timeline::stepBackInstruction(cpu &c) {
+  if (index.empty()) {
+    return false;
+  }
+  paused = true;
+  if (posInstr > 0) {
+    seek(c, posFrame, posInstr - 1);
+  } else if (posFrame > index.front().frame) {
+    uint64_t frame = posFrame - 1;
+    int length = frameLength(c, frame);
+    seek(c, frame, length > 0 ? length - 1 : 0);
+  } else {
+    return false;
+  }
+  return true;
+}
+
+bool timeline::stepForwardInstruction(cpu &c) {
+  if (!paused) {
+    return false;
+  }
+  // (frame, length) and (frame + 1, 0) differ only by the timers, so the
+  // end of a frame is skipped just as stepBackInstruction skips it
+  uint64_t frame = posFrame;
+  int instr = posInstr;
+  int length = frameLength(c, frame);
+  bool last = frame + 1 >= frames;
+  if (instr + 1 < length || (last && instr < length)) {
+    seek(c, frame, instr + 1);
+  } else if (!last) {
+    seek(c, frame + 1, 0);
+  } else {
+    seek(c, frame, instr);
+    return false;
+  }
+  return true;
+}
+
+void timeline::resume(cpu &c) {
+  if (!paused) {
+    return;
+  }
+  uint64_t keep = posFrame; // frames before this one stay recorded
+  if (posInstr > 0) {
+    // finish the partly run frame; it stays in the recording
+    for (int i = posInstr; i < ipf && !c.breakIPF && c.running; i++) {
+      c.executeCycle();
+    }
+    c.timers();
+    keep = posFrame + 1;
+  }
+  while (!index.empty() && index.back().frame >= keep) {
+    freeSlots.push_back(index.back().slot);
+    index.pop_back();
+  }
+  frames = keep;
+  posFrame = keep;
+  posInstr = 0;
+  paused = false;
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include "cpu.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+const size_t INPUT_HISTORY_FRAMES = 60 * 60 * 60; // one hour at 60Hz
+
+// Records a session so it can be stepped backwards. Every frame's input is
+// logged and the cpu is checkpointed; going back restores the nearest
+// earlier checkpoint and re-runs forward to the exact frame and instruction.
+//
+// Checkpoints are thinned so their spacing grows with age: recent history
+// is dense (a reverse step replays a frame or two) while the whole session
+// stays reachable with a fixed number of checkpoints. Input is kept for the
+// last INPUT_HISTORY_FRAMES frames; past that the oldest checkpoints go.
+// Nothing is allocated after init.
+class timeline {
+private:
+  struct entry {
+    uint64_t frame;
+    int slot;
+  };
+  std::vector<cpu> slots;      // checkpoint storage, reused when thinned
+  std::vector<entry> index;    // checkpoints in frame order
+  std::vector<int> freeSlots;
+  std::vector<uint16_t> inputs; // key bitmask per frame, a ring by frame
+  int ipf;
+  size_t maxCheckpoints;
+  uint64_t frames; // frames recorded so far
+  uint64_t firstFrame; // oldest frame whose input is still kept
+  uint64_t posFrame;
+  int posInstr;    // instructions into posFrame (0 = frame not started)
+  bool paused;
+
+  void checkpoint(const cpu &c, uint64_t frame);
+  void thin();
+  void forgetOldest();
+  void applyInput(cpu &c, uint64_t frame) const;
+  void seek(cpu &c, uint64_t frame, int instr);
+  int frameLength(cpu &c, uint64_t frame);
+
+public:
+  void init(int framesIPF, size_t checkpoints = 256);
+  // Call once per frame after input is latched and before the frame runs
+  void record(const cpu &c);
+  bool isPaused() const { return paused; }
+  uint64_t frame() const { return posFrame; }
+  int instruction() const { return posInstr; }
+
+  bool stepBackFrame(cpu &c);
+  bool stepBackInstruction(cpu &c);
+  bool stepForwardInstruction(cpu &c);
+  // Finishes the current frame and discards the recorded future
+  void resume(cpu &c);
+};
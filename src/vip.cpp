@@ -0,0 +1,249 @@
+#include "vip.h"
+#include "log.h"
+#include <cstdio>
+#include <cstring>
+
+namespace {
+
+const uint16_t VIP_WORK_AREA = 0xEA0; // interpreter stack, V and display
+
+// Reads a whole file of at most max bytes into buf
+bool readImage(const char *path, uint8_t *buf, size_t max, size_t &size) {
+  FILE *f = fopen(path, "rb");
+  if (!f) {
+    LOG_ERROR("vip_image_open_failed", "path", path);
+    return false;
+  }
+  size = fread(buf, 1, max, f);
+  bool tooBig = fgetc(f) != EOF;
+  fclose(f);
+  if (tooBig || size == 0) {
+    LOG_ERROR("vip_image_bad_size", "path", path, "max", max);
+    return false;
+  }
+  return true;
+}
+
+} // namespace
+
+bool vipMachine::load(const char *interpreterPath, const char *monitorPath,
+                      const cpu &boot) {
+  memset(ram, 0, sizeof(ram));
+  memset(monitor, 0, sizeof(monitor));
+  size_t size;
+  if (!readImage(interpreterPath, ram, 0x200, size)) {
+    return false;
+  }
+  if (monitorPath != NULL &&
+      !readImage(monitorPath, monitor, sizeof(monitor), size)) {
+    return false;
+  }
+  // the program, up to where the interpreter's own variables start
+  for (uint16_t addr = 0x200; addr < VIP_WORK_AREA; addr++) {
+    ram[addr] = boot.readMemory(addr);
+  }
+  for (uint16_t addr = VIP_WORK_AREA; addr < 0x1000; addr++) {
+    if (boot.readMemory(addr) != 0) {
+      LOG_ERROR("vip_program_too_big", "max", VIP_WORK_AREA - 0x200);
+      return false;
+    }
+  }
+
+  core.reset();
+  core.ram = ram;
+  core.rom = monitor;
+  core.R[1] = 0x0F00; // the monitor leaves the top RAM page in R1.1
+  keypad = 0;
+  displayOn = false;
+  line = 0;
+  lineCycle = 0;
+  interrupted = false;
+  fetches = 0;
+  cycleCount = 0;
+  programCycleCount = 0;
+  frameCount = 0;
+  interruptCount = 0;
+  return true;
+}
+
+// Moves the 1861 on by cycles, doing the DMA of each display line reached
+void vipMachine::advance(int cycles) {
+  cycleCount += cycles;
+  lineCycle += cycles;
+  while (lineCycle >= VIP_LINE_CYCLES) {
+    lineCycle -= VIP_LINE_CYCLES;
+    if (++line == VIP_LINES) {
+      line = 0;
+      frameCount++;
+      interrupted = false;
+    }
+    if (displayOn && line >= VIP_FIRST_DISPLAY_LINE &&
+        line < VIP_FIRST_DISPLAY_LINE + VIP_DISPLAY_LINES) {
+      for (int i = 0; i < VIP_DMA_LINE_CYCLES; i++) {
+        core.dmaOut(); // the 1802 is held for these cycles
+      }
+      lineCycle += VIP_DMA_LINE_CYCLES;
+      cycleCount += VIP_DMA_LINE_CYCLES;
+    }
+  }
+}
+
+// Acts on the I/O port the last instruction strobed
+void vipMachine::strobe() {
+  if (core.io.port == 1) {
+    displayOn = core.io.input;
+  } else if (core.io.port == 2 && !core.io.input) {
+    keypad = core.io.data & 0xF;
+  }
+  core.io.port = 0;
+}
+
+void vipMachine::step() {
+  int first = VIP_FIRST_DISPLAY_LINE;
+  int last = first + VIP_DISPLAY_LINES;
+  bool ef1 = displayOn && ((line >= first - 4 && line < first) ||
+                           (line >= last - 4 && line < last));
+  bool ef3 = keys != NULL && keys[keypad] != 0;
+  core.ef = ef1 | ef3 << 2;
+  if (displayOn && !interrupted && core.IE && line >= VIP_INTERRUPT_LINE &&
+      line < first) {
+    core.interrupt();
+    interrupted = true;
+    interruptCount++;
+  }
+  if (core.idle) {
+    advance(2); // until DMA or an interrupt wakes it
+    return;
+  }
+  if (core.read(core.R[core.P]) == 0x45) {
+    fetches++;
+  }
+  bool program = core.P != 1; // the interrupt routine runs with P = 1
+  int cycles = core.execute();
+  if (program) {
+    programCycleCount += cycles;
+  }
+  if (core.io.port != 0) {
+    strobe();
+  }
+  advance(cycles);
+}
+
+bool vipMachine::runToFetch(uint32_t lastFrame) {
+  // an interrupt taken at a fetch returns to the same one, which only
+  // counts if nothing has been fetched yet
+  uint64_t start = fetches;
+  do {
+    step();
+    if (frameCount > lastFrame) {
+      return false;
+    }
+  } while (!atFetch() || (fetches == start && start != 0));
+  return true;
+}
+
+namespace {
+
+bool fontAddress(uint16_t op) { return (op & 0xF0FF) == 0xF029; }
+
+} // namespace
+
+bool vipCompare::run(const cpu &boot, vipMachine &vip, uint32_t maxFrames,
+                     vipComparison &r) {
+  cpu c = boot;
+  memset(&r, 0, sizeof(r));
+  vip.keys = c.key;
+  bool fontI = false; // I was last set by FX29
+  uint32_t seen = 0;
+  // the interpreter's own setup runs up to its first fetch
+  bool fetching = vip.runToFetch(maxFrames);
+  while (fetching) {
+    // the frames that passed while the VIP ran the last instruction; a
+    // DXYN waiting on one draws straight after it, as the VIP does
+    for (; seen < vip.interrupts(); seen++) {
+      c.timers();
+      c.vblank();
+      if (c.vblankInterrupt) {
+        c.executeCycle();
+      }
+    }
+    uint16_t op = c.opcode;
+    if ((op & 0xF000) == 0xC000) {
+      c.V[(op >> 8) & 0xF] = vip.V((op >> 8) & 0xF);
+    }
+    if ((op & 0xF000) == 0xA000 || fontAddress(op)) {
+      fontI = fontAddress(op);
+    }
+
+    r.pc = c.pc;
+    r.opcode = op;
+    for (int i = 0; i < 16 && !r.diverged; i++) {
+      if (c.V[i] != vip.V(i)) {
+        r.diverged = true;
+        snprintf(r.what, sizeof(r.what), "V%X: cpu %02X, vip %02X", i,
+                 c.V[i], vip.V(i));
+      }
+    }
+    if (!r.diverged && (c.pc & 0xFFF) != (vip.pc() & 0xFFF)) {
+      r.diverged = true;
+      snprintf(r.what, sizeof(r.what), "pc: cpu %03X, vip %03X", c.pc,
+               vip.pc());
+    }
+    if (!r.diverged && !fontI && (c.I & 0xFFF) != (vip.I() & 0xFFF)) {
+      r.diverged = true;
+      snprintf(r.what, sizeof(r.what), "I: cpu %03X, vip %03X", c.I,
+               vip.I());
+    }
+    if (!r.diverged && c.delay_timer != vip.delayTimer()) {
+      r.diverged = true;
+      snprintf(r.what, sizeof(r.what), "delay timer: cpu %d, vip %d",
+               c.delay_timer, vip.delayTimer());
+    }
+    if (!r.diverged && (op == 0x00E0 || (op & 0xF000) == 0xD000)) {
+      for (int i = 0; i < 64 * 32 && !r.diverged; i++) {
+        if (c.gfx[i] != vip.pixel(i % 64, i / 64)) {
+          r.diverged = true;
+          snprintf(r.what, sizeof(r.what), "pixel %d,%d: cpu %d, vip %d",
+                   i % 64, i / 64, c.gfx[i], vip.pixel(i % 64, i / 64));
+        }
+      }
+    }
+    uint16_t store = op & 0xF0FF;
+    if (!r.diverged && (store == 0xF033 || store == 0xF055)) {
+      for (uint16_t a = 0x200; a < VIP_WORK_AREA && !r.diverged; a++) {
+        if (c.memory[a] != vip.readMemory(a)) {
+          r.diverged = true;
+          snprintf(r.what, sizeof(r.what), "memory %03X: cpu %02X, vip %02X",
+                   a, c.memory[a], vip.readMemory(a));
+        }
+      }
+    }
+    if (r.diverged) {
+      break;
+    }
+    if (!c.running) {
+      snprintf(r.what, sizeof(r.what), "cpu stopped on opcode %04X",
+               c.badOpcode);
+      break;
+    }
+
+    c.executeCycle();
+    r.instructions++;
+    if (c.keyWait) {
+      snprintf(r.what, sizeof(r.what), "waiting for a key at %03X", c.pc);
+      break;
+    }
+    fetching = vip.runToFetch(maxFrames);
+    if (!fetching) {
+      snprintf(r.what, sizeof(r.what), "ran %u frames", maxFrames);
+    }
+  }
+  if (r.instructions == 0 && !fetching) {
+    snprintf(r.what, sizeof(r.what), "the interpreter never fetched");
+    r.diverged = true;
+  }
+  r.frames = vip.frames();
+  r.cycles = vip.cycles();
+  r.programCycles = vip.programCycles();
+  return !r.diverged;
+}
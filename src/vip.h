@@ -0,0 +1,86 @@
+#pragma once
+#include "cdp1802.h"
+#include "cpu.h"
+#include "vipclock.h"
+#include <cstdint>
+
+// A COSMAC VIP with 4K of RAM running the original CHIP-8 interpreter,
+// for checking the cpu class against the real thing. The interpreter
+// image (512 bytes) is loaded at 0x0000 and the CHIP-8 program at 0x200,
+// where the VIP has them. Neither it nor the monitor ROM ships here; the
+// interpreter takes its font and FX0A's keypad routine from the monitor,
+// so without one those read zeros.
+//
+// The interpreter keeps V0-VF at 0xEF0, the display page at 0xF00, its PC
+// in R5, I in RA and the delay timer in R8.1.
+class vipMachine {
+private:
+  cdp1802 core;
+  uint8_t ram[4096];
+  uint8_t monitor[512];
+  uint8_t keypad;      // key selected by OUT 2
+  bool displayOn;      // INP 1 turns the 1861 on, OUT 1 off
+  int line, lineCycle; // position in the frame
+  bool interrupted;    // this frame's interrupt has been taken
+  uint64_t fetches;    // LDA R5s run; fetching takes two
+  uint64_t cycleCount;
+  uint64_t programCycleCount; // run outside the interrupt routine (P != 1)
+  uint32_t frameCount, interruptCount;
+
+  void advance(int cycles);
+  void strobe();
+
+public:
+  // keys (16 bytes, non-zero = held) is read while the machine runs
+  const uint8_t *keys;
+
+  // Loads the interpreter and monitor images (monitorPath may be NULL) and
+  // the program in boot's memory, and resets the 1802
+  bool load(const char *interpreterPath, const char *monitorPath,
+            const cpu &boot);
+  // Runs one 1802 instruction, or an interrupt, or a slice of idling
+  void step();
+  // True when the next instruction starts fetching a CHIP-8 instruction
+  bool atFetch() const {
+    return core.read(core.R[core.P]) == 0x45 && !(fetches & 1) && !core.idle;
+  }
+  // Runs to the next CHIP-8 fetch; false if frame lastFrame ends first
+  bool runToFetch(uint32_t lastFrame);
+
+  uint8_t V(int i) const { return ram[0xEF0 + i]; }
+  uint16_t pc() const { return core.R[5]; }
+  uint16_t I() const { return core.R[0xA]; }
+  uint8_t delayTimer() const { return core.R[8] >> 8; }
+  bool pixel(int x, int y) const {
+    return ram[0xF00 + y * 8 + x / 8] >> (7 - x % 8) & 1;
+  }
+  uint8_t readMemory(uint16_t addr) const { return ram[addr & 0xFFF]; }
+  uint32_t frames() const { return frameCount; }
+  uint32_t interrupts() const { return interruptCount; }
+  uint64_t cycles() const { return cycleCount; }
+  uint64_t programCycles() const { return programCycleCount; }
+};
+
+// Runs boot's program on boot and on a vipMachine side by side, one CHIP-8
+// instruction at a time, and compares V, I, pc, the delay timer, the
+// display after drawing and memory after stores. Both get the same VIP
+// frame interrupts. CXNN results are copied from the VIP, whose generator
+// differs, and I is not compared while it points at a font digit, which
+// lives at different addresses. Stops at the first difference, at FX0A
+// (no keys are pressed), or after maxFrames frames.
+struct vipComparison {
+  bool diverged;
+  uint64_t instructions;
+  uint32_t frames;
+  uint64_t cycles;   // 1802 machine cycles run
+  uint64_t programCycles; // of those, the interpreter's outside interrupts
+  uint16_t pc;       // where it stopped
+  uint16_t opcode;   // the instruction before the difference
+  char what[96];     // the difference, or why it stopped
+};
+
+class vipCompare {
+public:
+  static bool run(const cpu &boot, vipMachine &vip, uint32_t maxFrames,
+                  vipComparison &result);
+};
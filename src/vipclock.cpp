@@ -0,0 +1,104 @@
+#include "vipclock.h"
+
+// Machine cycles of the VIP interpreter's routines, from its listing
+const int FETCH_CYCLES = 40; // fetch, decode and jump through the table
+const int SKIP_CYCLES = 4;   // the extra pc increment of a taken skip
+const int CLEAR_CYCLES = 3078;
+const int DRAW_CYCLES = 26;
+const int ROW_ALIGNED_CYCLES = 34;   // sprite row landing on one byte
+const int ROW_UNALIGNED_CYCLES = 46; // shifted across two
+const int BCD_CYCLES = 80;
+const int BCD_DIGIT_CYCLES = 16; // per unit of each digit, counted down
+const int COPY_CYCLES = 14;      // FX55 / FX65, and again per register
+
+void vipClock::init() {
+  owed = 0;
+  cycleCount = 0;
+  instructionCount = 0;
+}
+
+// The cycles op takes beyond the fetch, from the state it starts in
+int vipClock::cost(const cpu &c, uint16_t op) {
+  uint8_t x = c.V[(op >> 8) & 0xF];
+  switch (op & 0xF000) {
+  case (0x0000):
+    return (op & 0xF) == 0x0 ? CLEAR_CYCLES : 10;
+  case (0x1000):
+    return 12;
+  case (0x2000):
+    return 26;
+  case (0x3000):
+  case (0x4000):
+  case (0x7000):
+    return 10;
+  case (0x5000):
+  case (0x9000):
+    return 14;
+  case (0x6000):
+    return 6;
+  case (0x8000):
+    return 44;
+  case (0xA000):
+    return 12;
+  case (0xB000):
+    return 22;
+  case (0xC000):
+    return 36;
+  case (0xD000): {
+    // rows past the bottom are skipped, as in cpu::step
+    int y = c.V[(op >> 4) & 0xF] % 32;
+    int rows = op & 0xF;
+    if (rows > 33 - y) {
+      rows = 33 - y;
+    }
+    int row = (x % 8) == 0 ? ROW_ALIGNED_CYCLES : ROW_UNALIGNED_CYCLES;
+    return DRAW_CYCLES + rows * row;
+  }
+  case (0xE000):
+    return 18;
+  default: // 0xF000
+    switch (op & 0xFF) {
+    case (0x1E):
+    case (0x29):
+      return 16;
+    case (0x33):
+      return BCD_CYCLES +
+             BCD_DIGIT_CYCLES * (x / 100 + (x / 10) % 10 + x % 10);
+    case (0x55):
+    case (0x65):
+      return COPY_CYCLES * (((op >> 8) & 0xF) + 2);
+    default:
+      return 10;
+    }
+  }
+}
+
+int vipClock::step(cpu &c, int budget) {
+  if (owed > 0) {
+    int spent = owed < budget ? owed : budget;
+    owed -= spent;
+    return spent;
+  }
+  uint16_t pc = c.pc;
+  uint16_t op = c.readMemory(pc) << 8 | c.readMemory(pc + 1);
+  int cycles = FETCH_CYCLES + cost(c, op);
+  c.executeCycle();
+  instructionCount++;
+  if (c.breakIPF || c.keyWait) {
+    // idles until the interrupt
+    cycleCount += budget;
+    return budget;
+  }
+  uint16_t family = op & 0xF000;
+  bool skip = family == 0x3000 || family == 0x4000 || family == 0x5000 ||
+              family == 0x9000 || family == 0xE000;
+  if (skip && c.pc == pc + 4) {
+    cycles += SKIP_CYCLES;
+  }
+  cycleCount += cycles;
+  if (cycles > budget) {
+    owed = cycles - budget;
+    return budget;
+  }
+  return cycles;
+}
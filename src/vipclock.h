@@ -0,0 +1,54 @@
+#pragma once
+#include "cpu.h"
+#include <cstdint>
+
+// COSMAC VIP timing, in 1802 machine cycles (8 clocks of the 1.76064 MHz
+// crystal). The 1861 draws 262 lines of 14 cycles, a 3668 cycle frame; the
+// 128 display lines each take 8 cycles of DMA. The interrupt is raised on
+// the two lines before them, and EF1 over the four lines at either end.
+const int VIP_LINE_CYCLES = 14;
+const int VIP_LINES = 262;
+const int VIP_INTERRUPT_LINE = 62;
+const int VIP_FIRST_DISPLAY_LINE = 64;
+const int VIP_DISPLAY_LINES = 128;
+const int VIP_DMA_LINE_CYCLES = 8;
+
+// The interpreter's interrupt routine holds the 1802 from the interrupt
+// until EF1 rises near the end of the display, re-pointing the DMA so each
+// row shows on four lines, then counts down the timers and returns. CHIP-8
+// code gets the lines outside that, less the DMA of the display's last
+// four lines and the routine's tail: noticing EF1 (it is polled once per
+// four lines), the timers and the return. --vip-compare prints the cycles
+// the interpreter actually got, to check this against.
+const int VIP_BUSY_LINES =
+    VIP_FIRST_DISPLAY_LINE + VIP_DISPLAY_LINES - 4 - VIP_INTERRUPT_LINE;
+const int VIP_INTERRUPT_TAIL_CYCLES = 35;
+const int VIP_CHIP8_CYCLES = (VIP_LINES - VIP_BUSY_LINES) * VIP_LINE_CYCLES -
+                             4 * VIP_DMA_LINE_CYCLES -
+                             VIP_INTERRUPT_TAIL_CYCLES;
+
+// Runs a cpu one instruction at a time, charging each the cycles the VIP
+// interpreter spends on it instead of counting instructions: fetch and
+// dispatch, the instruction's own routine, extra for a taken skip, and for
+// DXYN a cost per sprite row that grows when the sprite isn't byte
+// aligned. An instruction still running when the frame's cycles run out
+// finishes after the next interrupt, so its remaining cycles come out of
+// the following frame. DXYN waiting for the interrupt (the displayWait
+// quirk) and FX0A waiting for a key spend the rest of the frame.
+//
+// A stepper for runSession, with VIP_CHIP8_CYCLES as the frame budget.
+class vipClock {
+private:
+  int owed; // cycles of an instruction that ran past the last interrupt
+  uint64_t cycleCount, instructionCount;
+
+  static int cost(const cpu &c, uint16_t op);
+
+public:
+  void init();
+  // Spends up to budget (> 0) cycles of the frame: the rest of an
+  // unfinished instruction, or the next one. Returns the cycles spent.
+  int step(cpu &c, int budget);
+  uint64_t cycles() const { return cycleCount; }
+  uint64_t instructions() const { return instructionCount; }
+};